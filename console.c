@@ -1,17 +1,22 @@
 /* Implementation of simple command-line interface */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/select.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "console.h"
+#include "cpucycles.h"
 #include "report.h"
 #include "web.h"
 
@@ -20,6 +25,23 @@ int simulation = 0;
 int show_entropy = 0;
 static cmd_element_t *cmd_list = NULL;
 static param_element_t *param_list = NULL;
+
+/* The lists keep commands and parameters sorted for help and completion,
+ * while lookups by name go through open addressing tables. NAME_TABLE_SIZE
+ * is a power of two and stays well above the number of entries, so probe
+ * sequences are short.
+ */
+#define NAME_TABLE_SIZE 256
+
+typedef struct {
+    const char *name;
+    void *elem;
+} name_slot_t;
+
+static name_slot_t cmd_table[NAME_TABLE_SIZE];
+static name_slot_t param_table[NAME_TABLE_SIZE];
+static int cmd_count = 0;
+static int param_count = 0;
 static bool block_flag = false;
 static bool prompt_flag = true;
 
@@ -40,12 +62,18 @@ typedef struct __rio {
     int count;             /* Unread bytes in internal buffer */
     char *bufptr;          /* Next unread byte in internal buffer */
     char buf[RIO_BUFSIZE]; /* Internal buffer */
+    const char *map;       /* Whole file when mapped, NULL otherwise */
+    size_t map_size;       /* Size of mapped file */
+    size_t map_pos;        /* Next unread byte in map */
     struct __rio *prev;    /* Next element in stack */
 } rio_t;
 
 static rio_t *buf_stack;
 static char linebuf[RIO_BUFSIZE];
 
+/* Lines are at most RIO_BUFSIZE - 2 characters, hence this many words */
+#define MAXARGS (RIO_BUFSIZE / 2)
+
 /* Maximum file descriptor */
 static int fd_max = 0;
 
@@ -53,8 +81,12 @@ static int fd_max = 0;
 static int err_limit = 5;
 static int err_cnt = 0;
 static int echo = 0;
+static int profile = 0;
 
 static bool quit_flag = false;
+
+/* Binary trace being recorded, see do_record */
+static FILE *record_file = NULL;
 static char *prompt = "cmd> ";
 static bool has_infile = false;
 
@@ -71,6 +103,61 @@ static bool push_file(char *fname);
 static void pop_file();
 
 static bool interpret_cmda(int argc, char *argv[]);
+static bool dispatch_cmd(cmd_element_t *next_cmd, int argc, char *argv[]);
+static void record_cmd(int argc, char *argv[]);
+static bool loop_capture(int argc, char *argv[]);
+static void stop_recording();
+
+/* FNV-1a */
+static uint32_t hash_name(const char *name)
+{
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (uint8_t) *name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Return slot holding name, or the empty slot where it belongs */
+static name_slot_t *name_slot(name_slot_t *table, const char *name)
+{
+    uint32_t i = hash_name(name);
+    for (;; i++) {
+        name_slot_t *slot = &table[i & (NAME_TABLE_SIZE - 1)];
+        if (!slot->name || !strcmp(slot->name, name))
+            return slot;
+    }
+}
+
+/* Map name to elem, replacing earlier definition with the same name */
+static void name_insert(name_slot_t *table,
+                        int *count,
+                        const char *name,
+                        void *elem)
+{
+    name_slot_t *slot = name_slot(table, name);
+    if (!slot->name) {
+        /* Keep at least half of the slots empty */
+        if (2 * (*count + 1) > NAME_TABLE_SIZE)
+            report_event(MSG_FATAL,
+                         "Exceeded limit on command and parameter names");
+        (*count)++;
+        slot->name = name;
+    }
+    slot->elem = elem;
+}
+
+static void *name_find(name_slot_t *table, const char *name)
+{
+    return name_slot(table, name)->elem;
+}
+
+static void name_clear(name_slot_t *table, int *count)
+{
+    memset(table, 0, NAME_TABLE_SIZE * sizeof(name_slot_t));
+    *count = 0;
+}
 
 /* Add a new command */
 void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
@@ -87,8 +174,10 @@ void add_cmd(char *name, cmd_func_t operation, char *summary, char *param)
     cmd->operation = operation;
     cmd->summary = summary;
     cmd->param = param;
+    cmd->stats = NULL;
     cmd->next = next_cmd;
     *last_loc = cmd;
+    name_insert(cmd_table, &cmd_count, name, cmd);
 }
 
 /* Add a new parameter */
@@ -109,65 +198,141 @@ void add_param(char *name, int *valp, char *summary, setter_func_t setter)
     param->setter = setter;
     param->next = next_param;
     *last_loc = param;
+    name_insert(param_table, &param_count, name, param);
 }
 
-/* Parse a string into a command line */
-static char **parse_args(char *line, int *argcp)
+/* Split line in place at white space into at most MAXARGS words */
+static int parse_args(char *line, char *argv[])
 {
-    /* Must first determine how many arguments there are.
-     * Replace all white space with null characters
-     */
-    size_t len = strlen(line);
+    int argc = 0;
+    char *p = line;
+    while (*p) {
+        while (isspace((unsigned char) *p))
+            *p++ = '\0';
+        if (!*p)
+            break;
+        if (argc == MAXARGS)
+            return -1;
+        argv[argc++] = p;
+        while (*p && !isspace((unsigned char) *p))
+            p++;
+    }
+    return argc;
+}
+
+/* Latency of each command is kept in a histogram with 8 buckets per power of
+ * two nanoseconds, exact below 8 ns, so percentiles are within 12.5%.
+ */
+#define LAT_SUB_BITS 3
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+struct __cmd_stats {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t total_cycles;
+    uint64_t max_ns;
+    uint32_t hist[LAT_BUCKETS];
+};
+
+static int lat_bucket(uint64_t ns)
+{
+    if (ns < LAT_SUB)
+        return ns;
+    int e = 63 - __builtin_clzll(ns);
+    int sub = (ns >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1);
+    return (e - LAT_SUB_BITS + 1) * LAT_SUB + sub;
+}
 
-    /* First copy into buffer with each substring null-terminated */
-    char *buf = malloc_or_fail(len + 1, "parse_args");
-    buf[len] = '\0';
+/* Largest latency falling into bucket */
+static uint64_t lat_bucket_max(int b)
+{
+    if (b < LAT_SUB)
+        return b;
+    int e = b / LAT_SUB + LAT_SUB_BITS - 1;
+    uint64_t low = (uint64_t) (LAT_SUB + b % LAT_SUB) << (e - LAT_SUB_BITS);
+    return low + ((uint64_t) 1 << (e - LAT_SUB_BITS)) - 1;
+}
 
-    char *src = line;
-    char *dst = buf;
-    bool skipping = true;
-    int c;
-    int argc = 0;
-    while ((c = *src++) != '\0') {
-        if (isspace(c)) {
-            if (!skipping) {
-                /* Hit end of word */
-                *dst++ = '\0';
-                skipping = true;
-            }
-        } else {
-            if (skipping) {
-                /* Hit start of new word */
-                argc++;
-                skipping = false;
-            }
-            *dst++ = c;
-        }
+static void stats_add(cmd_element_t *cmd, uint64_t ns, uint64_t cycles)
+{
+    cmd_stats_t *s = cmd->stats;
+    if (!s) {
+        s = cmd->stats = calloc(1, sizeof(cmd_stats_t));
+        if (!s)
+            return;
     }
-    /* Let the last substring is null-terminated */
-    *dst++ = '\0';
+    s->count++;
+    s->total_ns += ns;
+    s->total_cycles += cycles;
+    if (ns > s->max_ns)
+        s->max_ns = ns;
+    s->hist[lat_bucket(ns)]++;
+}
 
-    /* Now assemble into array of strings */
-    char **argv = calloc_or_fail(argc, sizeof(char *), "parse_args");
-    src = buf;
-    for (int i = 0; i < argc; i++) {
-        argv[i] = strsave_or_fail(src, "parse_args");
-        src += strlen(argv[i]) + 1;
+/* Latency below which fraction p of the samples fall */
+static uint64_t stats_percentile(const cmd_stats_t *s, double p)
+{
+    uint64_t rank = (uint64_t) (p * s->count + 0.5), seen = 0;
+    if (rank < 1)
+        rank = 1;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += s->hist[b];
+        if (seen >= rank)
+            return lat_bucket_max(b) < s->max_ns ? lat_bucket_max(b)
+                                                 : s->max_ns;
+    }
+    return s->max_ns;
+}
+
+static void stats_show()
+{
+    report(1, "%-12s%10s%12s%10s%10s%10s%10s%10s%12s", "Command", "count",
+           "total(ms)", "mean(us)", "p50(us)", "p90(us)", "p99(us)", "max(us)",
+           "cycles");
+    for (cmd_element_t *c = cmd_list; c; c = c->next) {
+        const cmd_stats_t *s = c->stats;
+        if (!s || !s->count)
+            continue;
+        report(1, "%-12s%10lu%12.3f%10.2f%10.2f%10.2f%10.2f%10.2f%12lu",
+               c->name, (unsigned long) s->count, s->total_ns / 1e6,
+               s->total_ns / 1e3 / s->count, stats_percentile(s, 0.5) / 1e3,
+               stats_percentile(s, 0.9) / 1e3, stats_percentile(s, 0.99) / 1e3,
+               s->max_ns / 1e3,
+               (unsigned long) (s->total_cycles / s->count));
     }
+}
 
-    free_block(buf, len + 1);
-    *argcp = argc;
-    return argv;
+static bool do_stats(int argc, char *argv[])
+{
+    if (argc == 2 && !strcmp(argv[1], "reset")) {
+        for (cmd_element_t *c = cmd_list; c; c = c->next) {
+            if (c->stats)
+                memset(c->stats, 0, sizeof(cmd_stats_t));
+        }
+        return true;
+    }
+    if (argc != 1) {
+        report(1, "Use 'stats' to show, 'stats reset' to clear statistics");
+        return false;
+    }
+
+    stats_show();
+    return true;
 }
 
 /* Handles forced console termination for record_error and do_quit */
 static bool force_quit(int argc, char *argv[])
 {
+    if (profile)
+        stats_show();
+
     cmd_element_t *c = cmd_list;
     bool ok = true;
     while (c) {
         cmd_element_t *ele = c;
         c = c->next;
+        free(ele->stats);
         free_block(ele, sizeof(cmd_element_t));
     }
 
@@ -177,10 +342,16 @@ static bool force_quit(int argc, char *argv[])
         p = p->next;
         free_block(ele, sizeof(param_element_t));
     }
+    cmd_list = NULL;
+    param_list = NULL;
+    name_clear(cmd_table, &cmd_count);
+    name_clear(param_table, &param_count);
 
     while (buf_stack)
         pop_file();
 
+    stop_recording();
+
     for (int i = 0; i < quit_helper_cnt; i++) {
         ok = ok && quit_helpers[i](argc, argv);
     }
@@ -192,6 +363,7 @@ static bool force_quit(int argc, char *argv[])
 static void record_error()
 {
     err_cnt++;
+    web_error();
     if (err_cnt >= err_limit) {
         report(
             1,
@@ -206,12 +378,33 @@ static bool interpret_cmda(int argc, char *argv[])
     if (argc == 0)
         return true;
     /* Try to find matching command */
-    cmd_element_t *next_cmd = cmd_list;
+    return dispatch_cmd(name_find(cmd_table, argv[0]), argc, argv);
+}
+
+/* Execute command already looked up, NULL if there is no such command */
+static bool dispatch_cmd(cmd_element_t *next_cmd, int argc, char *argv[])
+{
+    /* Commands run by time or repeat belong to the outer one */
+    static int depth = 0;
+    bool json = json_output && depth == 0;
+    if (json)
+        json_begin(argv[0]);
+    depth++;
+
     bool ok = true;
-    while (next_cmd && strcmp(argv[0], next_cmd->name) != 0)
-        next_cmd = next_cmd->next;
+    uint64_t ns = 0;
     if (next_cmd) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int64_t cycles = cpucycles();
         ok = next_cmd->operation(argc, argv);
+        cycles = cpucycles() - cycles;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns = (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec -
+             start.tv_nsec;
+        /* quit has freed the command already */
+        if (!quit_flag)
+            stats_add(next_cmd, ns, cycles);
         if (!ok)
             record_error();
     } else {
@@ -220,22 +413,31 @@ static bool interpret_cmda(int argc, char *argv[])
         ok = false;
     }
 
+    depth--;
+    if (json)
+        json_end(ok, ns);
     return ok;
 }
 
-/* Execute a command from a command line */
+/* Execute a command from a command line, which is split up in the process */
 static bool interpret_cmd(char *cmdline)
 {
     if (quit_flag)
         return false;
 
-    int argc;
-    char **argv = parse_args(cmdline, &argc);
+    static char *argv[MAXARGS];
+    int argc = parse_args(cmdline, argv);
+    if (argc < 0) {
+        report(1, "Too many arguments, at most %d are allowed", MAXARGS);
+        record_error();
+        return false;
+    }
+    if (record_file)
+        record_cmd(argc, argv);
+    if (loop_capture(argc, argv))
+        return true;
     bool ok = interpret_cmda(argc, argv);
-    for (int i = 0; i < argc; i++)
-        free_string(argv[i]);
-    free_array(argv, argc, sizeof(char *));
-
+    report_flush();
     return ok;
 }
 
@@ -321,7 +523,6 @@ static bool do_option(int argc, char *argv[])
     for (int i = 1; i < argc; i++) {
         char *name = argv[i];
         int value = 0;
-        bool found = false;
         /* Get value from next argument */
         if (i + 1 >= argc) {
             report(1, "No value given for parameter %s", name);
@@ -330,23 +531,16 @@ static bool do_option(int argc, char *argv[])
             report(1, "Cannot parse '%s' as integer", argv[i]);
             return false;
         }
-        /* Find parameter in list */
-        param_element_t *plist = param_list;
-        while (!found && plist) {
-            if (strcmp(plist->name, name) == 0) {
-                int oldval = *plist->valp;
-                *plist->valp = value;
-                if (plist->setter)
-                    plist->setter(oldval);
-                found = true;
-            } else
-                plist = plist->next;
-        }
-        /* Didn't find parameter */
-        if (!found) {
+        /* Find parameter in table */
+        param_element_t *param = name_find(param_table, name);
+        if (!param) {
             report(1, "Unknown parameter '%s'", name);
             return false;
         }
+        int oldval = *param->valp;
+        *param->valp = value;
+        if (param->setter)
+            param->setter(oldval);
     }
 
     return true;
@@ -402,6 +596,281 @@ static bool do_time(int argc, char *argv[])
     return ok;
 }
 
+static bool do_repeat(int argc, char *argv[])
+{
+    int n;
+    if (argc < 3 || !get_int(argv[1], &n) || n < 0) {
+        report(1, "Use 'repeat <n> <command> ...'");
+        return false;
+    }
+
+    /* Look the command up once, it is the same for every round */
+    cmd_element_t *cmd = name_find(cmd_table, argv[2]);
+    bool ok = true;
+    for (int i = 0; ok && i < n && !quit_flag; i++)
+        ok = dispatch_cmd(cmd, argc - 2, argv + 2);
+    return ok;
+}
+
+/* Lines between loop and its end are kept split into words, which are packed
+ * one after another in loop_words, and run once the block is closed.
+ */
+typedef struct {
+    int argc;
+    size_t words;       /* Offset of first word in loop_words */
+    char **argv;        /* Set up when the block is closed */
+    cmd_element_t *cmd; /* Likewise */
+    int end;            /* Index of matching end for nested loop, else -1 */
+} loop_line_t;
+
+static int loop_depth = 0; /* Number of open loop blocks */
+static int loop_times;
+static loop_line_t *loop_lines = NULL;
+static size_t loop_nlines = 0, loop_maxlines = 0;
+static char *loop_words = NULL;
+static size_t loop_wlen = 0, loop_wmax = 0;
+
+static void *loop_grow(void *p, size_t *max, size_t need, size_t size)
+{
+    if (need <= *max)
+        return p;
+    while (*max < need)
+        *max = *max ? 2 * *max : 64;
+    p = realloc(p, *max * size);
+    if (!p)
+        report_event(MSG_FATAL, "Out of memory storing loop");
+    return p;
+}
+
+static void loop_store(int argc, char *argv[])
+{
+    loop_lines = loop_grow(loop_lines, &loop_maxlines, loop_nlines + 1,
+                           sizeof(*loop_lines));
+
+    loop_line_t *line = &loop_lines[loop_nlines++];
+    line->argc = argc;
+    line->words = loop_wlen;
+    line->end = -1;
+    for (int i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]) + 1;
+        loop_words = loop_grow(loop_words, &loop_wmax, loop_wlen + len, 1);
+        memcpy(loop_words + loop_wlen, argv[i], len);
+        loop_wlen += len;
+    }
+}
+
+/* Run lines [from, to) of the closed block, stopping at the first failure */
+static bool loop_run(int from, int to, int times)
+{
+    bool ok = true;
+    for (int t = 0; ok && t < times && !quit_flag; t++) {
+        for (int i = from; ok && i < to && !quit_flag; i++) {
+            loop_line_t *line = &loop_lines[i];
+            if (line->end < 0) {
+                ok = dispatch_cmd(line->cmd, line->argc, line->argv);
+                continue;
+            }
+
+            int n;
+            if (line->argc != 2 || !get_int(line->argv[1], &n) || n < 0) {
+                report(1, "Use 'loop <n>' to start block");
+                record_error();
+                return false;
+            }
+            ok = loop_run(i + 1, line->end, n);
+            i = line->end;
+        }
+    }
+    return ok;
+}
+
+/* Set up argv of every line, match nested blocks, and run the whole */
+static void loop_finish()
+{
+    size_t nwords = 0;
+    for (size_t i = 0; i < loop_nlines; i++)
+        nwords += loop_lines[i].argc;
+    char **argv = malloc(nwords * sizeof(char *) + 1);
+    int *opened = malloc(loop_nlines * sizeof(int) + 1);
+    if (!argv || !opened)
+        report_event(MSG_FATAL, "Out of memory storing loop");
+
+    int depth = 0;
+    char **next = argv;
+    for (size_t i = 0; i < loop_nlines; i++) {
+        loop_line_t *line = &loop_lines[i];
+        char *w = loop_words + line->words;
+        line->argv = next;
+        for (int j = 0; j < line->argc; j++) {
+            *next++ = w;
+            w += strlen(w) + 1;
+        }
+        line->cmd = name_find(cmd_table, line->argv[0]);
+        if (!strcmp(line->argv[0], "loop"))
+            opened[depth++] = i;
+        else if (!strcmp(line->argv[0], "end"))
+            loop_lines[opened[--depth]].end = i;
+    }
+
+    loop_run(0, loop_nlines, loop_times);
+
+    free(opened);
+    free(argv);
+    free(loop_lines);
+    free(loop_words);
+    loop_lines = NULL;
+    loop_words = NULL;
+    loop_nlines = loop_maxlines = 0;
+    loop_wlen = loop_wmax = 0;
+}
+
+/* Keep line for later while a loop block is open. Return true if it was */
+static bool loop_capture(int argc, char *argv[])
+{
+    if (!loop_depth || argc == 0)
+        return loop_depth > 0;
+
+    if (!strcmp(argv[0], "loop")) {
+        loop_depth++;
+    } else if (!strcmp(argv[0], "end") && --loop_depth == 0) {
+        loop_finish();
+        return true;
+    }
+    loop_store(argc, argv);
+    return true;
+}
+
+static bool do_loop(int argc, char *argv[])
+{
+    if (argc != 2 || !get_int(argv[1], &loop_times) || loop_times < 0) {
+        report(1, "Use 'loop <n>' to start block");
+        return false;
+    }
+    loop_depth = 1;
+    return true;
+}
+
+static bool do_end(int argc, char *argv[])
+{
+    report(1, "No loop block to end");
+    return false;
+}
+
+/* Binary traces hold the commands executed while recording, so that they can
+ * be replayed without reading and splitting text. The file starts with
+ * TRACE_MAGIC, followed by records made of unsigned LEB128 varints:
+ *
+ *   0, len, name              defines the next command id, counting from 0
+ *   id + 1, argc - 1, args... runs command id
+ *
+ * Each argument is (zigzag(value) << 1) | 1 for a decimal integer, which is
+ * handed to the command as the same text, or (len << 1) followed by the
+ * bytes of any other string.
+ */
+#define TRACE_MAGIC "qtrace1\n"
+
+static name_slot_t record_table[NAME_TABLE_SIZE];
+static int record_count = 0;
+
+static void put_varint(uint64_t v)
+{
+    while (v >= 0x80) {
+        putc((v & 0x7f) | 0x80, record_file);
+        v >>= 7;
+    }
+    putc(v, record_file);
+}
+
+static void put_define(const char *name)
+{
+    size_t len = strlen(name);
+    put_varint(0);
+    put_varint(len);
+    fwrite(name, 1, len, record_file);
+}
+
+/* Return true if s is the text printf("%d") gives for its value */
+static bool canonical_int(const char *s, int *value)
+{
+    char buf[16];
+    return get_int((char *) s, value) &&
+           snprintf(buf, sizeof(buf), "%d", *value) < sizeof(buf) &&
+           !strcmp(buf, s);
+}
+
+static void record_cmd(int argc, char *argv[])
+{
+    if (argc == 0)
+        return;
+
+    /* Commands read by source are recorded one by one */
+    if (!strcmp(argv[0], "source") || !strcmp(argv[0], "record"))
+        return;
+
+    cmd_element_t *cmd = name_find(cmd_table, argv[0]);
+    int id;
+    if (cmd) {
+        /* Table values are offset by one to tell them from empty slots */
+        id = (intptr_t) name_find(record_table, cmd->name) - 1;
+        if (id < 0) {
+            id = record_count;
+            name_insert(record_table, &record_count, cmd->name,
+                        (void *) (intptr_t) (id + 1));
+            put_define(cmd->name);
+        }
+    } else {
+        /* Unknown command still has to fail on replay */
+        id = record_count;
+        put_define(argv[0]);
+        record_count++;
+    }
+
+    put_varint(id + 1);
+    put_varint(argc - 1);
+    for (int i = 1; i < argc; i++) {
+        int value;
+        if (canonical_int(argv[i], &value)) {
+            uint32_t zigzag =
+                ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+            put_varint(((uint64_t) zigzag << 1) | 1);
+        } else {
+            size_t len = strlen(argv[i]);
+            put_varint(len << 1);
+            fwrite(argv[i], 1, len, record_file);
+        }
+    }
+}
+
+static void stop_recording()
+{
+    if (!record_file)
+        return;
+    if (fclose(record_file))
+        report(1, "Error writing binary trace: %s", strerror(errno));
+    record_file = NULL;
+}
+
+static bool do_record(int argc, char *argv[])
+{
+    if (argc > 2) {
+        report(1, "Use 'record <file>' to start, 'record' to stop recording");
+        return false;
+    }
+
+    stop_recording();
+    if (argc == 1)
+        return true;
+
+    record_file = fopen(argv[1], "wb");
+    if (!record_file) {
+        report(1, "Couldn't open binary trace '%s'", argv[1]);
+        return false;
+    }
+    fputs(TRACE_MAGIC, record_file);
+    name_clear(record_table, &record_count);
+    return true;
+}
+
 static bool use_linenoise = true;
 static int web_fd;
 
@@ -430,6 +899,8 @@ void init_cmd()
 {
     cmd_list = NULL;
     param_list = NULL;
+    name_clear(cmd_table, &cmd_count);
+    name_clear(param_table, &param_count);
     err_cnt = 0;
     quit_flag = false;
 
@@ -442,12 +913,23 @@ void init_cmd()
     ADD_COMMAND(log, "Copy output to file", "file");
     ADD_COMMAND(time, "Time command execution", "cmd arg ...");
     ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
+    ADD_COMMAND(repeat, "Run command n times", "n cmd arg ...");
+    ADD_COMMAND(loop, "Run the following commands up to 'end' n times", "n");
+    ADD_COMMAND(end, "End block started by loop", "");
+    ADD_COMMAND(stats, "Show latency of each command so far, or clear it",
+                "[reset]");
+    ADD_COMMAND(record,
+                "Record executed commands to binary trace file, or stop "
+                "recording if no file is given",
+                "[file]");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
     add_param("error", &err_limit, "Number of errors until exit", NULL);
     add_param("echo", &echo, "Do/don't echo commands", NULL);
     add_param("entropy", &show_entropy, "Show/Hide Shannon entropy", NULL);
+    add_param("json", &json_output, "Print one JSON object per command", NULL);
+    add_param("profile", &profile, "Show command latencies on quit", NULL);
 
     init_in();
     init_time(&last_time);
@@ -472,6 +954,21 @@ static bool push_file(char *fname)
     rnew->fd = fd;
     rnew->count = 0;
     rnew->bufptr = rnew->buf;
+    rnew->map = NULL;
+
+    /* Regular files are mapped, so that lines are found with memchr instead
+     * of being copied out of the buffer one character at a time
+     */
+    struct stat st;
+    if (fname && !fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            rnew->map = map;
+            rnew->map_size = st.st_size;
+            rnew->map_pos = 0;
+        }
+    }
     rnew->prev = buf_stack;
     buf_stack = rnew;
 
@@ -484,6 +981,8 @@ static void pop_file()
     if (buf_stack) {
         rio_t *rsave = buf_stack;
         buf_stack = rsave->prev;
+        if (rsave->map)
+            munmap((void *) rsave->map, rsave->map_size);
         close(rsave->fd);
         free_block(rsave, sizeof(rio_t));
     }
@@ -495,6 +994,35 @@ static void init_in()
     buf_stack = NULL;
 }
 
+/* Take next line of mapped file, with the same limit on its length */
+static char *readline_map()
+{
+    size_t avail = buf_stack->map_size - buf_stack->map_pos;
+    if (avail == 0) {
+        pop_file();
+        return NULL;
+    }
+
+    const char *start = buf_stack->map + buf_stack->map_pos;
+    const char *nl = memchr(start, '\n', avail);
+    size_t len = nl ? (size_t) (nl - start) + 1 : avail;
+    if (len > RIO_BUFSIZE - 2)
+        len = RIO_BUFSIZE - 2;
+    memcpy(linebuf, start, len);
+    buf_stack->map_pos += len;
+
+    if (linebuf[len - 1] != '\n')
+        linebuf[len++] = '\n';
+    linebuf[len] = '\0';
+
+    if (echo) {
+        report_noreturn(1, prompt);
+        report_noreturn(1, linebuf);
+    }
+
+    return linebuf;
+}
+
 /* Read command from input file.
  * When hit EOF, close that file and return NULL
  */
@@ -505,6 +1033,8 @@ static char *readline()
 
     if (!buf_stack)
         return NULL;
+    if (buf_stack->map)
+        return readline_map();
 
     for (int cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
         if (buf_stack->count <= 0) {
@@ -565,7 +1095,6 @@ static bool cmd_done()
  * nfds should be set to the maximum file descriptor for network sockets.
  * If nfds == 0, this indicates that there is no pending network activity
  */
-int web_connfd;
 static int cmd_select(int nfds,
                       fd_set *readfds,
                       fd_set *writefds,
@@ -592,7 +1121,18 @@ static int cmd_select(int nfds,
         if (web_fd != -1)
             FD_SET(web_fd, readfds);
 
-        if (infd == STDIN_FILENO && prompt_flag) {
+        if (infd == STDIN_FILENO && web_fd > 0 && !isatty(infd)) {
+            /* Without a terminal, linenoise never calls back, so wait for
+             * requests here. Lines already buffered are read first.
+             */
+            if (buf_stack->count <= 0 && web_eventmux(linebuf) > 0) {
+                interpret_cmd(linebuf);
+            } else {
+                char *cmdline = readline();
+                if (cmdline)
+                    interpret_cmd(cmdline);
+            }
+        } else if (infd == STDIN_FILENO && prompt_flag) {
             char *cmdline = linenoise(prompt);
             if (cmdline)
                 interpret_cmd(cmdline);
@@ -610,6 +1150,11 @@ static int cmd_select(int nfds,
 bool finish_cmd()
 {
     bool ok = true;
+    if (loop_depth) {
+        report(1, "Missing end of loop block");
+        loop_depth = 0;
+        err_cnt++;
+    }
     if (!quit_flag)
         ok = ok && do_quit(0, NULL);
     has_infile = false;
@@ -667,9 +1212,9 @@ bool run_console(char *infile_name)
     if (!has_infile) {
         char *cmdline;
         while (use_linenoise && (cmdline = linenoise(prompt))) {
-            interpret_cmd(cmdline);
             line_history_add(cmdline);       /* Add to the history. */
             line_history_save(HISTORY_FILE); /* Save the history on disk. */
+            interpret_cmd(cmdline);
             line_free(cmdline);
             while (buf_stack && buf_stack->fd != STDIN_FILENO)
                 cmd_select(0, NULL, NULL, NULL, NULL);
@@ -686,3 +1231,162 @@ bool run_console(char *infile_name)
 
     return err_cnt == 0;
 }
+
+/* Cursor over a mapped binary trace */
+typedef struct {
+    const uint8_t *pos, *end;
+} trace_cursor_t;
+
+static bool get_varint(trace_cursor_t *t, uint64_t *v)
+{
+    *v = 0;
+    for (int shift = 0; t->pos < t->end && shift < 64; shift += 7) {
+        uint8_t b = *t->pos++;
+        *v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/* Decode the arguments of one command into argv, with their text in buf */
+static bool get_args(trace_cursor_t *t, int argc, char *argv[], char *buf)
+{
+    char *p = buf, *end = buf + RIO_BUFSIZE;
+    for (int i = 1; i < argc; i++) {
+        uint64_t v;
+        if (!get_varint(t, &v))
+            return false;
+
+        argv[i] = p;
+        if (v & 1) {
+            /* Decimal digits written backwards, as snprintf would be slower
+             * than the whole rest of the decoding
+             */
+            uint32_t zigzag = v >> 1;
+            uint32_t mag = (zigzag >> 1) + (zigzag & 1);
+            char digits[12];
+            int n = 0;
+            do {
+                digits[n++] = '0' + mag % 10;
+                mag /= 10;
+            } while (mag);
+            if (end - p < n + 2)
+                return false;
+            if (zigzag & 1)
+                *p++ = '-';
+            while (n)
+                *p++ = digits[--n];
+            *p++ = '\0';
+        } else {
+            uint64_t len = v >> 1;
+            if (len >= (uint64_t) (end - p) ||
+                len > (uint64_t) (t->end - t->pos))
+                return false;
+            memcpy(p, t->pos, len);
+            p[len] = '\0';
+            t->pos += len;
+            p += len + 1;
+        }
+    }
+    return true;
+}
+
+bool run_replay(char *file_name)
+{
+    int fd = open(file_name, O_RDONLY);
+    if (fd < 0) {
+        report(1, "ERROR: Could not open binary trace '%s'", file_name);
+        return false;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (!fstat(fd, &st) && st.st_size > 0)
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    size_t magic_len = strlen(TRACE_MAGIC);
+    if (map == MAP_FAILED || st.st_size < magic_len ||
+        memcmp(map, TRACE_MAGIC, magic_len)) {
+        report(1, "ERROR: '%s' is not a binary trace", file_name);
+        if (map != MAP_FAILED)
+            munmap(map, st.st_size);
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    trace_cursor_t t = {(const uint8_t *) map + magic_len,
+                        (const uint8_t *) map + st.st_size};
+
+    /* Commands resolved once when defined, with their names for argv[0] */
+    size_t n_defs = 0, max_defs = 0;
+    cmd_element_t **defs = NULL;
+    char **names = NULL;
+
+    static char *argv[MAXARGS];
+    static char argbuf[RIO_BUFSIZE];
+    bool corrupt = false;
+    while (t.pos < t.end && !quit_flag) {
+        uint64_t id, nargs;
+        if (!get_varint(&t, &id)) {
+            corrupt = true;
+            break;
+        }
+
+        if (id == 0) {
+            uint64_t len;
+            if (!get_varint(&t, &len) || len > (uint64_t) (t.end - t.pos)) {
+                corrupt = true;
+                break;
+            }
+            if (n_defs == max_defs) {
+                max_defs = max_defs ? 2 * max_defs : 32;
+                defs = realloc(defs, max_defs * sizeof(*defs));
+                names = realloc(names, max_defs * sizeof(*names));
+                if (!defs || !names)
+                    report_event(MSG_FATAL, "Out of memory replaying trace");
+            }
+            names[n_defs] = strndup((const char *) t.pos, len);
+            if (!names[n_defs])
+                report_event(MSG_FATAL, "Out of memory replaying trace");
+            defs[n_defs] = name_find(cmd_table, names[n_defs]);
+            n_defs++;
+            t.pos += len;
+            continue;
+        }
+
+        if (id > n_defs || !get_varint(&t, &nargs) || nargs >= MAXARGS ||
+            !get_args(&t, nargs + 1, argv, argbuf)) {
+            corrupt = true;
+            break;
+        }
+        int argc = nargs + 1;
+        argv[0] = names[id - 1];
+
+        if (echo) {
+            report_noreturn(1, prompt);
+            for (int i = 0; i < argc; i++)
+                report_noreturn(1, i < argc - 1 ? "%s " : "%s\n", argv[i]);
+        }
+        if (!loop_capture(argc, argv))
+            dispatch_cmd(defs[id - 1], argc, argv);
+        report_flush();
+
+        /* Let source and the like run to completion */
+        while (!cmd_done())
+            cmd_select(0, NULL, NULL, NULL, NULL);
+    }
+
+    if (corrupt) {
+        report(1, "ERROR: Binary trace '%s' is corrupt at offset %zu",
+               file_name, (size_t) (t.pos - (const uint8_t *) map));
+        record_error();
+    }
+
+    for (size_t i = 0; i < n_defs; i++)
+        free(names[i]);
+    free(names);
+    free(defs);
+    munmap(map, st.st_size);
+    return err_cnt == 0;
+}
@@ -18,12 +18,16 @@ typedef bool (*cmd_func_t)(int argc, char *argv[]);
 
 /* Information about each command */
 
+/* Latency statistics, kept by the console */
+typedef struct __cmd_stats cmd_stats_t;
+
 /* Organized as linked list in alphabetical order */
 typedef struct __cmd_element {
     char *name;
     cmd_func_t operation;
     char *summary;
     char *param;
+    cmd_stats_t *stats;
     struct __cmd_element *next;
 } cmd_element_t;
 
@@ -68,6 +72,11 @@ bool finish_cmd();
  */
 bool run_console(char *infile_name);
 
+/* Run commands from binary trace written by the record command.
+ * Return true if no errors occurred.
+ */
+bool run_replay(char *file_name);
+
 /* Callback function to complete command by linenoise */
 void completion(const char *buf, line_completions_t *lc);
 
@@ -0,0 +1,299 @@
+/** Empirical estimation of time complexity
+ *
+ * An operation is timed on queues whose sizes grow geometrically, then the
+ * least cycle counts are fitted against each candidate growth model f(n)
+ * with a single scale factor c, i.e. t(n) = c * f(n). The fit is done by
+ * least squares in log space, log t = log c + log f(n), so that every size
+ * weighs the same regardless of its absolute cycle count, and the models are
+ * not nested into each other. The model with the smallest residual wins,
+ * unless a slower growing model fits almost as well.
+ */
+
+#include <math.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include <stdint.h>
+#include <string.h>
+
+#include "complexity.h"
+#include "cpucycles.h"
+#include "queue.h"
+#include "random.h"
+
+/* Strings the queues are filled with */
+#define POOL_SIZE 4096
+static char pool[POOL_SIZE][8];
+
+/* Operations taking no argument besides the queue */
+#define CPLX_OPS                     \
+    _(ih, q_insert_head(l, pool[0])) \
+    _(it, q_insert_tail(l, pool[0])) \
+    _(size, q_size(l))               \
+    _(reverse, q_reverse(l))         \
+    _(swap, q_swap(l))               \
+    _(dm, q_delete_mid(l))           \
+    _(sort, q_sort(l, false))        \
+    _(ascend, q_ascend(l))           \
+    _(descend, q_descend(l))
+
+#define _(name, stmt)                             \
+    static int64_t op_##name(struct list_head *l) \
+    {                                             \
+        int64_t before = cpucycles();             \
+        stmt;                                     \
+        return cpucycles() - before;              \
+    }
+CPLX_OPS
+#undef _
+
+/* Removed element is released outside of the measurement */
+#define CPLX_OP_REMOVE(name, fn)                  \
+    static int64_t op_##name(struct list_head *l) \
+    {                                             \
+        int64_t before = cpucycles();             \
+        element_t *e = fn(l, NULL, 0);            \
+        int64_t after = cpucycles();              \
+        if (!e)                                   \
+            return -1;                            \
+        q_release_element(e);                     \
+        return after - before;                    \
+    }
+
+CPLX_OP_REMOVE(rh, q_remove_head)
+CPLX_OP_REMOVE(rt, q_remove_tail)
+
+static const struct {
+    const char *name;
+    int64_t (*run)(struct list_head *l);
+} ops[] = {
+#define _(name, stmt) {#name, op_##name},
+    CPLX_OPS
+#undef _
+    {"rh", op_rh},
+    {"rt", op_rt},
+};
+
+static const char *names[N_CPLX] = {
+#define _(x, name) name,
+    CPLX_CLASSES
+#undef _
+};
+
+static const char *keys[N_CPLX] = {
+#define _(x, name) #x,
+    CPLX_CLASSES
+#undef _
+};
+
+const char *cplx_name(cplx_class_t c)
+{
+    return c < N_CPLX ? names[c] : "unknown";
+}
+
+bool cplx_parse(const char *s, cplx_class_t *c)
+{
+    for (int i = 0; i < N_CPLX; i++) {
+        if (!strcmp(s, keys[i])) {
+            *c = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void prepare_pool(void)
+{
+    randombytes((uint8_t *) pool, sizeof(pool));
+    for (size_t i = 0; i < POOL_SIZE; i++) {
+        for (size_t j = 0; j < sizeof(pool[i]) - 1; j++)
+            pool[i][j] = 'a' + (uint8_t) pool[i][j] % 26;
+        pool[i][sizeof(pool[i]) - 1] = '\0';
+    }
+}
+
+/* Create queue of n strings drawn from the pool */
+static struct list_head *build(size_t n, uintptr_t seed)
+{
+    struct list_head *l = q_new();
+    if (!l)
+        return NULL;
+
+    for (size_t i = 0; i < n; i++) {
+        seed = random_shuffle(seed);
+        if (!q_insert_tail(l, pool[seed % POOL_SIZE])) {
+            q_free(l);
+            return NULL;
+        }
+    }
+    return l;
+}
+
+/* State of a sweep, handed through the guard of the caller */
+typedef struct {
+    int64_t (*run)(struct list_head *l);
+    cplx_result_t *res;
+    int s;
+    uintptr_t seed;
+} sweep_t;
+
+/* Time run at size s of the sweep, keeping its least cycle count */
+static bool measure_size(void *arg)
+{
+    sweep_t *sw = arg;
+    cplx_result_t *res = sw->res;
+    int s = sw->s;
+
+    res->cycles[s] = INFINITY;
+#if defined(__GLIBC__)
+    /* Nodes freed by the previous size wait in free lists in the order they
+     * were released, from which the next queues would be allocated all over
+     * the heap. The more sweeps ran, the more superlinear a traversal looked.
+     */
+    malloc_trim(0);
+#endif
+    for (int r = 0; r < CPLX_REPEATS; r++) {
+        sw->seed = random_shuffle(sw->seed);
+        struct list_head *l = build(res->n[s], sw->seed);
+        if (!l)
+            return false;
+        int64_t cycles = sw->run(l);
+        q_free(l);
+        if (cycles < 0)
+            return false;
+        /* Interrupts and cache misses only ever add cycles */
+        if (cycles < res->cycles[s])
+            res->cycles[s] = (double) cycles;
+    }
+    return true;
+}
+
+/* Time run over every size once */
+static bool sweep(int64_t (*run)(struct list_head *l),
+                  cplx_guard_t guard,
+                  cplx_result_t *res)
+{
+    sweep_t sw = {.run = run, .res = res, .seed = (uintptr_t) pool[0][0]};
+    for (sw.s = 0; sw.s < CPLX_N_SIZES; sw.s++) {
+        res->n[sw.s] = (size_t) (CPLX_MIN_N * pow(2, sw.s / 2.0) + 0.5);
+        if (!guard(measure_size, &sw, res->n[sw.s] * CPLX_REPEATS))
+            return false;
+    }
+
+    cplx_fit(res);
+    return true;
+}
+
+bool cplx_measure(const char *op,
+                  cplx_class_t expect,
+                  cplx_guard_t guard,
+                  cplx_result_t *res)
+{
+    int64_t (*run)(struct list_head *l) = NULL;
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (!strcmp(op, ops[i].name))
+            run = ops[i].run;
+    }
+    if (!run)
+        return false;
+
+    for (int cnt = 0; cnt < CPLX_TRIES; cnt++) {
+        prepare_pool();
+        if (!sweep(run, guard, res))
+            return false;
+        if (res->best <= expect)
+            break;
+    }
+    return true;
+}
+
+/* Logarithm of the growth model evaluated at n */
+static double log_model(cplx_class_t c, double n)
+{
+    switch (c) {
+    case CPLX(logn):
+        return log(log2(n));
+    case CPLX(n):
+        return log(n);
+    case CPLX(nlogn):
+        return log(n) + log(log2(n));
+    case CPLX(n2):
+        return 2 * log(n);
+    default:
+        return 0;
+    }
+}
+
+/* Best log c is the mean residual, what remains is their variance. A single
+ * size hit by a burst of noise can tip the balance between neighbouring
+ * models, so the point that fits worst is left out.
+ */
+static double trimmed_rss(const double *r)
+{
+    double best = INFINITY;
+    for (int skip = 0; skip < CPLX_N_SIZES; skip++) {
+        double mean = 0, rss = 0;
+        for (int i = 0; i < CPLX_N_SIZES; i++) {
+            if (i != skip)
+                mean += r[i];
+        }
+        mean /= CPLX_N_SIZES - 1;
+        for (int i = 0; i < CPLX_N_SIZES; i++) {
+            if (i != skip)
+                rss += (r[i] - mean) * (r[i] - mean);
+        }
+        if (rss < best)
+            best = rss;
+    }
+    return best;
+}
+
+void cplx_fit(cplx_result_t *res)
+{
+    double logn[CPLX_N_SIZES], logt[CPLX_N_SIZES];
+    for (int i = 0; i < CPLX_N_SIZES; i++) {
+        logn[i] = log((double) res->n[i]);
+        /* A sample can not take less than one cycle */
+        logt[i] = log(res->cycles[i] < 1 ? 1 : res->cycles[i]);
+    }
+
+    res->best = CPLX(1);
+    for (int c = 0; c < N_CPLX; c++) {
+        double r[CPLX_N_SIZES];
+        for (int i = 0; i < CPLX_N_SIZES; i++)
+            r[i] = logt[i] - log_model(c, res->n[i]);
+        res->rss[c] = trimmed_rss(r);
+        if (res->rss[c] < res->rss[res->best])
+            res->best = c;
+    }
+
+    /* Cache and branch predictor effects bend the curves slightly upwards */
+    for (int c = 0; c < res->best; c++) {
+        if (res->rss[c] * (1 - CPLX_MARGIN) <= res->rss[res->best]) {
+            res->best = c;
+            break;
+        }
+    }
+
+    double runner_up = INFINITY;
+    for (int c = 0; c < N_CPLX; c++) {
+        if (c != res->best && res->rss[c] < runner_up)
+            runner_up = res->rss[c];
+    }
+    res->confidence = runner_up > 0 ? 1 - res->rss[res->best] / runner_up : 0;
+    if (res->confidence < 0)
+        res->confidence = 0;
+
+    double mean_n = 0, mean_t = 0, sxy = 0, sxx = 0;
+    for (int i = 0; i < CPLX_N_SIZES; i++) {
+        mean_n += logn[i];
+        mean_t += logt[i];
+    }
+    mean_n /= CPLX_N_SIZES;
+    mean_t /= CPLX_N_SIZES;
+    for (int i = 0; i < CPLX_N_SIZES; i++) {
+        sxy += (logn[i] - mean_n) * (logt[i] - mean_t);
+        sxx += (logn[i] - mean_n) * (logn[i] - mean_n);
+    }
+    res->exponent = sxx > 0 ? sxy / sxx : 0;
+}
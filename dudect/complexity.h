@@ -0,0 +1,81 @@
+#ifndef DUDECT_COMPLEXITY_H
+#define DUDECT_COMPLEXITY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Queue sizes swept geometrically in half octaves from CPLX_MIN_N up to
+ * CPLX_MIN_N * 16. Smaller queues take too few cycles to be timed without
+ * serializing the cycle counter, and bigger ones fall out of cache, which
+ * makes every traversal look superlinear.
+ */
+#define CPLX_MIN_N 512
+#define CPLX_N_SIZES 9
+
+/* Number of timed runs per size, the fastest of which is kept */
+#define CPLX_REPEATS 15
+
+/* Number of sweeps before a slower than expected result is believed, since a
+ * loaded machine can bend a single sweep
+ */
+#define CPLX_TRIES 5
+
+/* Fraction by which a faster growing model must lower the residual of a
+ * slower one to be preferred
+ */
+#define CPLX_MARGIN 0.25
+
+/* Candidate growth models, from the slowest growing to the fastest */
+#define CPLX_CLASSES       \
+    _(1, "O(1)")           \
+    _(logn, "O(log n)")    \
+    _(n, "O(n)")           \
+    _(nlogn, "O(n log n)") \
+    _(n2, "O(n^2)")
+
+#define CPLX(x) CPLX_##x
+
+typedef enum {
+#define _(x, name) CPLX(x),
+    CPLX_CLASSES
+#undef _
+    N_CPLX
+} cplx_class_t;
+
+typedef struct {
+    size_t n[CPLX_N_SIZES];
+    double cycles[CPLX_N_SIZES]; /* Least cycle count at each size */
+    double rss[N_CPLX];          /* Residual of each model in log space */
+    cplx_class_t best;
+    double confidence; /* 1 - rss[best] / rss[runner-up], within [0, 1] */
+    double exponent;   /* Slope of the log-log regression */
+} cplx_result_t;
+
+/* Name of growth model, such as "O(n log n)" */
+const char *cplx_name(cplx_class_t c);
+
+/* Parse model given as "1", "logn", "n", "nlogn" or "n2" */
+bool cplx_parse(const char *s, cplx_class_t *c);
+
+/* Run measure(arg), which works on queues of elements elements in all, under
+ * a time limit or fault handler of the caller. Return false if it failed or
+ * was cut short.
+ */
+typedef bool (*cplx_guard_t)(bool (*measure)(void *arg),
+                             void *arg,
+                             size_t elements);
+
+/* Time operation over the size sweep and fit the result, sweeping again up to
+ * CPLX_TRIES times while it grows faster than expect (N_CPLX for no limit).
+ * Each size is timed through guard. Return false if op is unknown, or the
+ * queue implementation misbehaves or runs out of time.
+ */
+bool cplx_measure(const char *op,
+                  cplx_class_t expect,
+                  cplx_guard_t guard,
+                  cplx_result_t *res);
+
+/* Fit res->cycles against every model and fill in the rest of res */
+void cplx_fit(cplx_result_t *res);
+
+#endif
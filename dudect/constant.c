@@ -12,7 +12,16 @@
  */
 static struct list_head *l = NULL;
 
-#define dut_new() ((void) (l = q_new()))
+/* Building and freeing a queue of up to POOL_SIZE elements for every sample
+ * would take far longer than the operation being measured. Instead, the
+ * elements are allocated once and chained in the pool, whose first n nodes
+ * are cut into the queue under test in O(1) since their addresses are known,
+ * and spliced back once the sample is taken.
+ */
+#define POOL_SIZE 10000
+static LIST_HEAD(pool);
+static struct list_head *nodes[POOL_SIZE];
+static bool pool_ready = false;
 
 #define dut_size(n)                                \
     do {                                           \
@@ -20,29 +29,79 @@ static struct list_head *l = NULL;
             q_size(l);                             \
     } while (0)
 
-#define dut_insert_head(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_head(l, s); \
-    } while (0)
-
-#define dut_insert_tail(s, n)    \
-    do {                         \
-        int j = n;               \
-        while (j--)              \
-            q_insert_tail(l, s); \
-    } while (0)
+/* Let queue under test hold the first n nodes of the pool */
+#define dut_take(n) list_cut_position(l, &pool, (n) ? nodes[(n) - 1] : &pool)
 
-#define dut_free() ((void) (q_free(l)))
+/* Give the nodes back, in the order they were taken */
+#define dut_return() list_splice_init(l, &pool)
 
 static char random_string[N_MEASURES][8];
 static int random_string_iter = 0;
 
+/* Release the node the measured insertion added, provided it is found next to
+ * the pool node it was expected to be linked to
+ */
+static bool dut_drop(struct list_head *node, const struct list_head *neighbor)
+{
+    if (node == l || node == neighbor)
+        return false;
+    if (node->next != neighbor && node->prev != neighbor)
+        return false;
+    list_del(node);
+    q_release_element(list_entry(node, element_t, list));
+    return true;
+}
+
 /* Implement the necessary queue interface to simulation */
-void init_dut(void)
+bool init_dut(void)
 {
-    l = NULL;
+    if (pool_ready)
+        return true;
+
+    /* Drop whatever is left of a pool spoiled by a failed measurement */
+    free_dut();
+
+    l = q_new();
+    if (!l)
+        return false;
+
+    /* Insert at head, so that freeing from head releases the most recent
+     * allocation first, which cautious mode finds at once. Strings are random
+     * like the measured operands, lest timing that depends on values be
+     * hidden.
+     */
+    char s[8];
+    for (int i = 0; i < POOL_SIZE; i++) {
+        randombytes((uint8_t *) s, 7);
+        s[7] = 0;
+        if (!q_insert_head(&pool, s)) {
+            free_dut();
+            return false;
+        }
+    }
+
+    int i = 0;
+    struct list_head *node;
+    list_for_each(node, &pool)
+        nodes[i++] = node;
+
+    pool_ready = true;
+    return true;
+}
+
+void free_dut(void)
+{
+    element_t *e, *safe;
+    if (l) {
+        dut_return();
+        q_free(l);
+        l = NULL;
+    }
+    list_for_each_entry_safe(e, safe, &pool, list) {
+        list_del(&e->list);
+        q_release_element(e);
+    }
+    pool_ready = false;
 }
 
 static char *get_random_string(void)
@@ -75,88 +134,85 @@ bool measure(int64_t *before_ticks,
     assert(mode == DUT(insert_head) || mode == DUT(insert_tail) ||
            mode == DUT(remove_head) || mode == DUT(remove_tail));
 
+    if (!pool_ready)
+        return false;
+
+    bool ok = true;
     switch (mode) {
     case DUT(insert_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+        for (size_t i = DROP_SIZE; ok && i < N_MEASURES - DROP_SIZE; i++) {
             char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
+            int n = *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000;
+            dut_take(n);
             int before_size = q_size(l);
             before_ticks[i] = cpucycles();
-            dut_insert_head(s, 1);
+            q_insert_head(l, s);
             after_ticks[i] = cpucycles();
             int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
+            ok = before_size == after_size - 1 &&
+                 dut_drop(l->next, n ? nodes[0] : l);
+            dut_return();
         }
         break;
     case DUT(insert_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+        for (size_t i = DROP_SIZE; ok && i < N_MEASURES - DROP_SIZE; i++) {
             char *s = get_random_string();
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
+            int n = *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000;
+            dut_take(n);
             int before_size = q_size(l);
             before_ticks[i] = cpucycles();
-            dut_insert_tail(s, 1);
+            q_insert_tail(l, s);
             after_ticks[i] = cpucycles();
             int after_size = q_size(l);
-            dut_free();
-            if (before_size != after_size - 1)
-                return false;
+            ok = before_size == after_size - 1 &&
+                 dut_drop(l->prev, n ? nodes[n - 1] : l);
+            dut_return();
         }
         break;
     case DUT(remove_head):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
+        for (size_t i = DROP_SIZE; ok && i < N_MEASURES - DROP_SIZE; i++) {
+            int n = *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1;
+            dut_take(n);
             int before_size = q_size(l);
             before_ticks[i] = cpucycles();
             element_t *e = q_remove_head(l, NULL, 0);
             after_ticks[i] = cpucycles();
             int after_size = q_size(l);
+            ok = before_size == after_size + 1 && e && &e->list == nodes[0];
+            /* Put the element back where it came from */
             if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
+                list_add(&e->list, l);
+            dut_return();
         }
         break;
     case DUT(remove_tail):
-        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
+        for (size_t i = DROP_SIZE; ok && i < N_MEASURES - DROP_SIZE; i++) {
+            int n = *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1;
+            dut_take(n);
             int before_size = q_size(l);
             before_ticks[i] = cpucycles();
             element_t *e = q_remove_tail(l, NULL, 0);
             after_ticks[i] = cpucycles();
             int after_size = q_size(l);
+            ok = before_size == after_size + 1 && e &&
+                 &e->list == nodes[n - 1];
             if (e)
-                q_release_element(e);
-            dut_free();
-            if (before_size != after_size + 1)
-                return false;
+                list_add_tail(&e->list, l);
+            dut_return();
         }
         break;
     default:
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
-            dut_new();
-            dut_insert_head(
-                get_random_string(),
-                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
+            dut_take(*(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
             before_ticks[i] = cpucycles();
             dut_size(1);
             after_ticks[i] = cpucycles();
-            dut_free();
+            dut_return();
         }
     }
-    return true;
+
+    /* The pool can not be trusted once the queue under test misbehaved */
+    if (!ok)
+        pool_ready = false;
+    return ok;
 }
@@ -26,7 +26,8 @@ enum {
 #undef _
 };
 
-void init_dut();
+bool init_dut(void);
+void free_dut(void);
 void prepare_inputs(uint8_t *input_data, uint8_t *classes);
 bool measure(int64_t *before_ticks,
              int64_t *after_ticks,
@@ -38,6 +38,17 @@
 
 #include "constant.h"
 #include "fixture.h"
+
+/* Progress lines redraw the terminal, which has no place among the objects
+ * of JSON output. report.h is not included, as its report() clashes with
+ * the one below.
+ */
+extern int json_output;
+#define progress(...)            \
+    do {                         \
+        if (!json_output)        \
+            printf(__VA_ARGS__); \
+    } while (0)
 #include "ttest.h"
 
 #define ENOUGH_MEASURE 10000
@@ -83,11 +94,11 @@ static bool report(void)
     double number_traces_max_t = t->n[0] + t->n[1];
     double max_tau = max_t / sqrt(number_traces_max_t);
 
-    printf("\033[A\033[2K");
-    printf("measure: %7.2lf M, ", (number_traces_max_t / 1e6));
+    progress("\033[A\033[2K");
+    progress("measure: %7.2lf M, ", (number_traces_max_t / 1e6));
     if (number_traces_max_t < ENOUGH_MEASURE) {
-        printf("not enough measurements (%.0f still to go).\n",
-               ENOUGH_MEASURE - number_traces_max_t);
+        progress("not enough measurements (%.0f still to go).\n",
+                 ENOUGH_MEASURE - number_traces_max_t);
         return false;
     }
 
@@ -101,8 +112,8 @@ static bool report(void)
      *            detect the leak, if present. "barely detect the
      *            leak" = have a t value greater than 5.
      */
-    printf("max t: %+7.2f, max tau: %.2e, (5/tau)^2: %.2e.\n", max_t, max_tau,
-           (double) (5 * 5) / (double) (max_tau * max_tau));
+    progress("max t: %+7.2f, max tau: %.2e, (5/tau)^2: %.2e.\n", max_t,
+             max_tau, (double) (5 * 5) / (double) (max_tau * max_tau));
 
     /* Definitely not constant time */
     if (max_t > t_threshold_bananas)
@@ -135,6 +146,8 @@ static bool doit(int mode)
     differentiate(exec_times, before_ticks, after_ticks);
     update_statistics(exec_times, classes);
     ret &= report();
+    /* Progress is shown live, although console output is buffered */
+    fflush(stdout);
 
     free(before_ticks);
     free(after_ticks);
@@ -147,7 +160,6 @@ static bool doit(int mode)
 
 static void init_once(void)
 {
-    init_dut();
     t_init(t);
 }
 
@@ -157,15 +169,19 @@ static bool test_const(char *text, int mode)
     t = malloc(sizeof(t_context_t));
 
     for (int cnt = 0; cnt < TEST_TRIES; ++cnt) {
-        printf("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
+        /* The pool is rebuilt after an attempt in which it was spoiled */
+        if (!init_dut())
+            break;
+        progress("Testing %s...(%d/%d)\n\n", text, cnt, TEST_TRIES);
         init_once();
         for (int i = 0; i < ENOUGH_MEASURE / (N_MEASURES - DROP_SIZE * 2) + 1;
              ++i)
             result = doit(mode);
-        printf("\033[A\033[2K\033[A\033[2K");
+        progress("\033[A\033[2K\033[A\033[2K");
         if (result)
             break;
     }
+    free_dut();
     free(t);
     return result;
 }
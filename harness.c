@@ -1,11 +1,21 @@
 /* Test support code */
 
+/* dladdr() is only declared with _GNU_SOURCE on Linux */
+#if defined(__linux__) || defined(__GNU__)
+#define _GNU_SOURCE
+#endif
+
+#include <dlfcn.h>
+#include <inttypes.h>
 #include <setjmp.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "report.h"
@@ -36,28 +46,54 @@
 typedef struct __block_element {
     struct __block_element *next, *prev;
     size_t payload_size;
+    void *site;          /* Caller allocating it, if profiling was on */
     size_t magic_header; /* Marker to see if block seems legitimate */
-    unsigned char payload[0];
+    /* Keep payload as aligned as malloc would, whatever the header holds */
+    _Alignas(max_align_t) unsigned char payload[0];
     /* Also place magic number at tail of every block */
 } block_element_t;
 
 static block_element_t *allocated = NULL;
 static size_t allocated_count = 0;
+static alloc_stats_t stats = {0};
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+int alloc_profile = 0;
+
+/* Allocations aggregated by call site, kept in an open addressing table.
+ * Sites that do not fit are lumped together under a NULL site.
+ */
+#define SITE_SLOTS 1024
+
+typedef struct {
+    void *site;
+    size_t allocs, frees;
+    size_t bytes; /* Bytes allocated since start */
+    int64_t live; /* Bytes still allocated */
+} site_stats_t;
+
+static site_stats_t sites[SITE_SLOTS];
+static site_stats_t other_sites;
+
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
 static bool error_occurred = false;
 static char *error_message = "";
 
-static int time_limit = 1;
+int time_limit = 1000000;
+int time_per_elem = 0;
+int time_report = 0;
+
+static size_t time_elements = 0;
 
 /* Data for managing exceptions */
 static jmp_buf env;
 static volatile sig_atomic_t jmp_ready = false;
 static bool time_limited = false;
+static int64_t time_budget;  /* Budget of the running operation in us */
+static struct timespec time_start;
 
 /* For test_malloc and test_calloc */
 typedef enum {
@@ -113,6 +149,31 @@ static block_element_t *find_header(void *p)
     return b;
 }
 
+/* Histogram bucket of an allocation of size bytes */
+static int size_bucket(size_t size)
+{
+    if (size <= 1)
+        return 0;
+    int bucket = 64 - __builtin_clzll((unsigned long long) size - 1);
+    return bucket < ALLOC_BUCKETS ? bucket : ALLOC_BUCKETS - 1;
+}
+
+static site_stats_t *site_find(void *site)
+{
+    size_t i = (uint64_t) ((uintptr_t) site >> 2) * 0x9E3779B97F4A7C15ULL >> 54;
+
+    for (size_t probe = 0; probe < SITE_SLOTS; probe++) {
+        site_stats_t *s = &sites[(i + probe) % SITE_SLOTS];
+        if (s->site == site)
+            return s;
+        if (!s->site) {
+            s->site = site;
+            return s;
+        }
+    }
+    return &other_sites;
+}
+
 /* Given pointer to block, find its footer */
 static size_t *find_footer(block_element_t *b)
 {
@@ -122,7 +183,7 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
-static void *alloc(alloc_t alloc_type, size_t size)
+static void *alloc(alloc_t alloc_type, size_t size, void *site)
 {
     if (noallocate_mode) {
         char *msg_alloc_forbidden[] = {
@@ -153,6 +214,8 @@ static void *alloc(alloc_t alloc_type, size_t size)
     new_block->magic_header = MAGICHEADER;
     // cppcheck-suppress nullPointerRedundantCheck
     new_block->payload_size = size;
+    /* Blocks allocated before profiling began are never charged */
+    new_block->site = alloc_profile ? site : NULL;
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
     memset(p, !alloc_type * FILLCHAR, size);
@@ -165,6 +228,20 @@ static void *alloc(alloc_t alloc_type, size_t size)
         allocated->prev = new_block;
     allocated = new_block;
     allocated_count++;
+    stats.allocs++;
+    stats.bytes += size;
+    stats.sizes[size_bucket(size)]++;
+    if (stats.bytes > stats.peak)
+        stats.peak = stats.bytes;
+    if (stats.bytes > stats.window_peak)
+        stats.window_peak = stats.bytes;
+
+    if (alloc_profile) {
+        site_stats_t *s = site_find(site);
+        s->allocs++;
+        s->bytes += size;
+        s->live += size;
+    }
 
     return p;
 }
@@ -173,7 +250,7 @@ static void *alloc(alloc_t alloc_type, size_t size)
 
 void *test_malloc(size_t size)
 {
-    return alloc(TEST_MALLOC, size);
+    return alloc(TEST_MALLOC, size, __builtin_return_address(0));
 }
 
 // cppcheck-suppress unusedFunction
@@ -184,7 +261,7 @@ void *test_calloc(size_t nelem, size_t elsize)
      */
     if (!nelem || !elsize || nelem > SIZE_MAX / elsize)
         return NULL;
-    return alloc(TEST_CALLOC, nelem * elsize);
+    return alloc(TEST_CALLOC, nelem * elsize, __builtin_return_address(0));
 }
 
 void test_free(void *p)
@@ -220,6 +297,13 @@ void test_free(void *p)
     if (bn)
         bn->prev = bp;
 
+    stats.frees++;
+    stats.bytes -= b->payload_size;
+    if (b->site) {
+        site_stats_t *s = site_find(b->site);
+        s->frees++;
+        s->live -= b->payload_size;
+    }
     free(b);
     allocated_count--;
 }
@@ -228,7 +312,8 @@ void test_free(void *p)
 char *test_strdup(const char *s)
 {
     size_t len = strlen(s) + 1;
-    void *new = test_malloc(len);
+    /* Charge the copy to the caller rather than to this function */
+    void *new = alloc(TEST_MALLOC, len, __builtin_return_address(0));
     if (!new)
         return NULL;
 
@@ -240,6 +325,65 @@ size_t allocation_check()
     return allocated_count;
 }
 
+void allocation_stats(alloc_stats_t *s)
+{
+    *s = stats;
+}
+
+void allocation_window()
+{
+    stats.window_peak = stats.bytes;
+}
+
+static int cmp_site_bytes(const void *a, const void *b)
+{
+    const site_stats_t *sa = a, *sb = b;
+    return (sa->bytes < sb->bytes) - (sa->bytes > sb->bytes);
+}
+
+void allocation_sites_report()
+{
+    if (!alloc_profile)
+        return;
+
+    static site_stats_t sorted[SITE_SLOTS + 1];
+    size_t n = 0;
+    for (size_t i = 0; i < SITE_SLOTS; i++) {
+        if (sites[i].site)
+            sorted[n++] = sites[i];
+    }
+    if (other_sites.allocs || other_sites.frees)
+        sorted[n++] = other_sites;
+    qsort(sorted, n, sizeof(sorted[0]), cmp_site_bytes);
+
+    size_t shown = n < (size_t) alloc_profile ? n : (size_t) alloc_profile;
+    report(1, "Allocations by call site (top %zu of %zu):", shown, n);
+    report(1, "  %10s %12s %10s %12s  %s", "allocs", "bytes", "frees", "live",
+           "site");
+    for (size_t i = 0; i < shown; i++) {
+        const site_stats_t *s = &sorted[i];
+        char where[256] = "other sites";
+        Dl_info info;
+
+        /* The offset into the object file can be fed to addr2line -e */
+        if (s->site && dladdr(s->site, &info) && info.dli_fname) {
+            const char *file = strrchr(info.dli_fname, '/');
+            uintptr_t addr = (uintptr_t) s->site;
+            file = file ? file + 1 : info.dli_fname;
+            int len = snprintf(where, sizeof(where), "%s+0x%" PRIxPTR, file,
+                               addr - (uintptr_t) info.dli_fbase);
+            if (info.dli_sname && len > 0 && len < (int) sizeof(where))
+                snprintf(where + len, sizeof(where) - len,
+                         " (%s+0x%" PRIxPTR ")", info.dli_sname,
+                         addr - (uintptr_t) info.dli_saddr);
+        } else if (s->site) {
+            snprintf(where, sizeof(where), "%p", s->site);
+        }
+        report(1, "  %10zu %12zu %10zu %12" PRId64 "  %s", s->allocs, s->bytes,
+               s->frees, s->live, where);
+    }
+}
+
 /* Implementation of functions for testing */
 
 /* Set/unset cautious mode.
@@ -266,6 +410,49 @@ bool error_check()
     return e;
 }
 
+void set_time_elements(size_t n)
+{
+    time_elements = n;
+}
+
+/* Arm SIGALRM to fire once the budget of the operation is spent */
+static void time_start_op()
+{
+    time_budget =
+        time_limit ? time_limit + (int64_t) time_per_elem * time_elements / 1000
+                   : 0;
+    if (time_budget > 0) {
+        struct itimerval it = {
+            .it_value = {.tv_sec = time_budget / 1000000,
+                         .tv_usec = time_budget % 1000000},
+        };
+        setitimer(ITIMER_REAL, &it, NULL);
+    }
+    time_limited = true;
+    clock_gettime(CLOCK_MONOTONIC, &time_start);
+}
+
+static void time_stop_op()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (time_budget > 0) {
+        struct itimerval it = {0};
+        setitimer(ITIMER_REAL, &it, NULL);
+    }
+    time_limited = false;
+
+    if (!time_report)
+        return;
+    int64_t us = (now.tv_sec - time_start.tv_sec) * 1000000 +
+                 (now.tv_nsec - time_start.tv_nsec) / 1000;
+    if (time_budget > 0)
+        report(1, "Time: %" PRId64 " us of %" PRId64 " us (%zu elements)", us,
+               time_budget, time_elements);
+    else
+        report(1, "Time: %" PRId64 " us (%zu elements)", us, time_elements);
+}
+
 /* Prepare for a risky operation using setjmp.
  * Function returns true for initial return, false for error return
  */
@@ -274,10 +461,8 @@ bool exception_setup(bool limit_time)
     if (sigsetjmp(env, 1)) {
         /* Got here from longjmp */
         jmp_ready = false;
-        if (time_limited) {
-            alarm(0);
-            time_limited = false;
-        }
+        if (time_limited)
+            time_stop_op();
 
         if (error_message)
             report_event(MSG_ERROR, error_message);
@@ -287,20 +472,16 @@ bool exception_setup(bool limit_time)
 
     /* Got here from initial call */
     jmp_ready = true;
-    if (limit_time) {
-        alarm(time_limit);
-        time_limited = true;
-    }
+    if (limit_time)
+        time_start_op();
     return true;
 }
 
 /* Call once past risky code */
 void exception_cancel()
 {
-    if (time_limited) {
-        alarm(0);
-        time_limited = false;
-    }
+    if (time_limited)
+        time_stop_op();
 
     jmp_ready = false;
     error_message = "";
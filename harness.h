@@ -21,9 +21,50 @@ char *test_strdup(const char *s);
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+#define ALLOC_BUCKETS 32
+
+typedef struct {
+    size_t allocs;      /* Blocks allocated since start */
+    size_t frees;       /* Blocks freed since start */
+    size_t bytes;       /* Payload bytes currently allocated */
+    size_t peak;        /* Most payload bytes allocated at once */
+    size_t window_peak; /* Same, since the last allocation_window() */
+    /* Blocks allocated since start by size: bucket i counts those of up to
+     * 2^i bytes, the last one all the bigger ones too
+     */
+    size_t sizes[ALLOC_BUCKETS];
+} alloc_stats_t;
+
+/* Report allocation totals */
+void allocation_stats(alloc_stats_t *stats);
+
+/* Restart window_peak from the bytes currently allocated */
+void allocation_window();
+
+/* Number of call sites to list in the allocation report, 0 to not record
+ * them at all
+ */
+extern int alloc_profile;
+
+/* Print the call sites that allocated the most bytes */
+void allocation_sites_report();
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Time budget of a timed operation: time_limit microseconds, plus
+ * time_per_elem nanoseconds for each element it works on. A time_limit of 0
+ * lifts the limit.
+ */
+extern int time_limit;
+extern int time_per_elem;
+
+/* Report the time taken by every timed operation */
+extern int time_report;
+
+/* Set the number of elements the next timed operations work on */
+void set_time_elements(size_t n);
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -3,6 +3,9 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 #include <signal.h>
 #include <spawn.h>
 #include <stdio.h>
@@ -19,6 +22,7 @@
 #include <time.h>
 #endif
 
+#include "dudect/complexity.h"
 #include "dudect/fixture.h"
 #include "list.h"
 #include "random.h"
@@ -75,6 +79,8 @@ static int string_length = MAXSTRING;
 
 static int descend = 0;
 
+static int relink = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
@@ -86,6 +92,20 @@ typedef enum {
 /* Forward declarations */
 static bool q_show(int vlevel);
 
+/* Scale the time budget of the next operation to the elements it works on:
+ * those of every queue, since merge and free go through all of them, plus
+ * the extra ones it inserts.
+ */
+static void time_budget(size_t extra)
+{
+    size_t n = extra;
+    queue_contex_t *ctx;
+
+    list_for_each_entry(ctx, &chain.head, chain)
+        n += ctx->size;
+    set_time_elements(n);
+}
+
 static bool do_free(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -113,6 +133,7 @@ static bool do_free(int argc, char *argv[])
     if (current) {
         list_del(&current->chain);
 
+        time_budget(0);
         if (exception_setup(true))
             q_free(current->q);
         exception_cancel();
@@ -147,6 +168,7 @@ static bool do_new(int argc, char *argv[])
 
     bool ok = true;
 
+    time_budget(0);
     if (exception_setup(true)) {
         queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
         list_add_tail(&qctx->chain, &chain.head);
@@ -163,21 +185,68 @@ static bool do_new(int argc, char *argv[])
     return ok && !error_check();
 }
 
-/* TODO: Add a buf_size check of if the buf_size may be less
- * than MIN_RANDSTR_LEN.
+/* Random strings are generated RANDSTR_BATCH at a time, so that the
+ * randomness is drawn with a single call and the mapping below runs over one
+ * flat array the compiler can vectorize.
  */
-static void fill_rand_string(char *buf, size_t buf_size)
+#define RANDSTR_BATCH 512
+static char randstr_pool[RANDSTR_BATCH][MAX_RANDSTR_LEN];
+static int randstr_next = RANDSTR_BATCH;
+
+/* Map each 16-bit lane into [0, range) by multiply-shift. The result is only
+ * unbiased when the low half of the product is at least 65536 % range, which
+ * fails with probability below range / 65536, so those rare lanes are redrawn
+ * afterwards instead of branching inside the loop.
+ */
+static void map_uniform(uint16_t *lanes, uint8_t *out, size_t n, uint32_t range)
 {
-    size_t len = 0;
-    while (len < MIN_RANDSTR_LEN)
-        len = rand() % buf_size;
+    const uint16_t threshold = 65536 % range;
+    bool redo = false;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t m = (uint32_t) lanes[i] * range;
+        out[i] = m >> 16;
+        redo |= (uint16_t) m < threshold;
+    }
+    if (!redo)
+        return;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t m = (uint32_t) lanes[i] * range;
+        while ((uint16_t) m < threshold) {
+            randombytes((uint8_t *) &lanes[i], sizeof(lanes[i]));
+            m = (uint32_t) lanes[i] * range;
+        }
+        out[i] = m >> 16;
+    }
+}
 
-    uint64_t randstr_buf_64[MAX_RANDSTR_LEN] = {0};
-    randombytes((uint8_t *) randstr_buf_64, len * sizeof(uint64_t));
-    for (size_t n = 0; n < len; n++)
-        buf[n] = charset[randstr_buf_64[n] % (sizeof(charset) - 1)];
+static void fill_rand_pool(void)
+{
+    static uint16_t lanes[RANDSTR_BATCH * (MAX_RANDSTR_LEN + 1)];
+    static uint8_t idx[RANDSTR_BATCH * (MAX_RANDSTR_LEN + 1)];
+    const size_t nchars = RANDSTR_BATCH * MAX_RANDSTR_LEN;
+
+    randombytes((uint8_t *) lanes, sizeof(lanes));
+    map_uniform(lanes, idx, nchars, sizeof(charset) - 1);
+    map_uniform(lanes + nchars, idx + nchars, RANDSTR_BATCH,
+                MAX_RANDSTR_LEN - MIN_RANDSTR_LEN);
+
+    char *chars = &randstr_pool[0][0];
+    for (size_t i = 0; i < nchars; i++)
+        chars[i] = charset[idx[i]];
+    for (size_t i = 0; i < RANDSTR_BATCH; i++)
+        randstr_pool[i][MIN_RANDSTR_LEN + idx[nchars + i]] = '\0';
+    randstr_next = 0;
+}
 
-    buf[len] = '\0';
+/* Return random string of MIN_RANDSTR_LEN to MAX_RANDSTR_LEN - 1 lowercase
+ * letters. It stays valid until RANDSTR_BATCH more strings are requested.
+ */
+static char *next_rand_string(void)
+{
+    if (randstr_next == RANDSTR_BATCH)
+        fill_rand_pool();
+    return randstr_pool[randstr_next++];
 }
 
 /* insertion */
@@ -200,7 +269,6 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
     }
 
     char *lasts = NULL;
-    char randstr_buf[MAX_RANDSTR_LEN];
     int reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
@@ -216,20 +284,19 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         }
     }
 
-    if (!strcmp(inserts, "RAND")) {
+    if (!strcmp(inserts, "RAND"))
         need_rand = true;
-        inserts = randstr_buf;
-    }
 
     if (!current || !current->q)
         report(3, "Warning: Calling insert %s on null queue",
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
+    time_budget(reps);
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
+                inserts = next_rand_string();
             bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
                                         : q_insert_head(current->q, inserts);
             if (rval) {
@@ -288,6 +355,40 @@ static bool do_it(int argc, char *argv[])
     return queue_insert(POS_TAIL, argc, argv);
 }
 
+/* Append n random strings, skipping the per-element checks of it */
+static bool do_prefill(int argc, char *argv[])
+{
+    int reps;
+    if (argc != 2 || !get_int(argv[1], &reps) || reps < 1) {
+        report(1, "Usage: prefill <n>");
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Calling prefill on null queue");
+        return false;
+    }
+    error_check();
+
+    bool ok = true;
+    time_budget(reps);
+    if (exception_setup(true)) {
+        for (int r = 0; ok && r < reps; r++) {
+            if (q_insert_tail(current->q, next_rand_string())) {
+                current->size++;
+            } else if (++fail_count >= fail_limit) {
+                report(1, "ERROR: Insertion failed (%d failures total)",
+                       fail_count);
+                ok = false;
+            }
+        }
+    }
+    exception_cancel();
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool queue_remove(position_t pos, int argc, char *argv[])
 {
     /* FIXME: It is known that both functions is_remove_tail_const() and
@@ -349,6 +450,7 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
     error_check();
 
     element_t *re = NULL;
+    time_budget(0);
     if (current && exception_setup(true))
         re = pos == POS_TAIL
                  ? q_remove_tail(current->q, removes, string_length + 1)
@@ -463,6 +565,7 @@ static bool do_dedup(int argc, char *argv[])
     }
 
     bool ok = true;
+    time_budget(0);
     if (exception_setup(true))
         ok = q_delete_dup(current->q);
     exception_cancel();
@@ -524,6 +627,7 @@ static bool do_reverse(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
+    time_budget(0);
     if (current && exception_setup(true))
         q_reverse(current->q);
     exception_cancel();
@@ -552,6 +656,7 @@ static bool do_size(int argc, char *argv[])
         report(3, "Warning: Calling size on null queue");
     error_check();
 
+    time_budget(0);
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
             cnt = q_size(current->q);
@@ -612,6 +717,7 @@ bool do_sort(int argc, char *argv[])
                "number of elements %d is too large, exceeds the limit %d.",
                current->size, MAX_NODES);
 
+    time_budget(0);
     if (current && exception_setup(true))
         q_sort(current->q, descend);
     exception_cancel();
@@ -681,6 +787,7 @@ static bool do_dm(int argc, char *argv[])
     error_check();
 
     bool ok = true;
+    time_budget(0);
     if (exception_setup(true))
         ok = q_delete_mid(current->q);
     exception_cancel();
@@ -707,6 +814,7 @@ static bool do_swap(int argc, char *argv[])
     error_check();
 
     set_noallocate_mode(true);
+    time_budget(0);
     if (exception_setup(true))
         q_swap(current->q);
     exception_cancel();
@@ -739,6 +847,7 @@ static bool do_ascend(int argc, char *argv[])
         report(3, "Warning: Calling ascend on single node");
     error_check();
 
+    time_budget(0);
     if (exception_setup(true))
         current->size = q_ascend(current->q);
     set_noallocate_mode(false);
@@ -786,6 +895,7 @@ static bool do_descend(int argc, char *argv[])
         report(3, "Warning: Calling descend on single node");
     error_check();
 
+    time_budget(0);
     if (exception_setup(true))
         current->size = q_descend(current->q);
     set_noallocate_mode(false);
@@ -833,6 +943,7 @@ static bool do_reverseK(int argc, char *argv[])
     }
 
     set_noallocate_mode(true);
+    time_budget(0);
     if (exception_setup(true))
         q_reverseK(current->q, k);
     exception_cancel();
@@ -857,6 +968,7 @@ static bool do_merge(int argc, char *argv[])
 
     int len = 0;
     set_noallocate_mode(true);
+    time_budget(0);
     if (current && exception_setup(true))
         len = q_merge(&chain.head, descend);
     exception_cancel();
@@ -959,6 +1071,7 @@ static bool q_show(int vlevel)
     struct list_head *ori = current->q;
     struct list_head *cur = current->q->next;
 
+    time_budget(0);
     if (exception_setup(true)) {
         while (ok && ori != cur && cnt < current->size) {
             element_t *e = list_entry(cur, element_t, list);
@@ -1010,6 +1123,67 @@ static bool do_show(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Resident set size of the process in bytes, 0 if it is not known */
+static size_t resident_bytes()
+{
+    unsigned long size, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f)
+        return 0;
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static bool do_mem(int argc, char *argv[])
+{
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    /* Changes are shown since the previous mem command */
+    static alloc_stats_t last;
+    alloc_stats_t now;
+    allocation_stats(&now);
+
+    report(1, "Allocated: %zu bytes in %zu blocks, peak %zu bytes", now.bytes,
+           allocation_check(), now.peak);
+    report(1, "Since last mem: %+lld bytes, %zu allocs, %zu frees, peak %zu "
+           "bytes",
+           (long long) now.bytes - (long long) last.bytes,
+           now.allocs - last.allocs, now.frees - last.frees, now.window_peak);
+    report(1, "Block sizes:");
+    for (int i = 0; i < ALLOC_BUCKETS; i++) {
+        size_t n = now.sizes[i], delta = n - last.sizes[i];
+        if (!n)
+            continue;
+        if (i < ALLOC_BUCKETS - 1)
+            report(1, "  <= %-10llu %10zu (+%zu)", 1ULL << i, n, delta);
+        else
+            report(1, "  >  %-10llu %10zu (+%zu)", 1ULL << (i - 1), n, delta);
+    }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    /* Space malloc holds but has not handed out shows how fragmented the
+     * heap has become
+     */
+    struct mallinfo2 mi = mallinfo2();
+    size_t heap = mi.arena + mi.hblkhd;
+    report(1, "Heap: %zu bytes, %zu in use, %zu free (%.1f%%)", heap,
+           mi.uordblks + mi.hblkhd, mi.fordblks,
+           heap ? 100.0 * mi.fordblks / heap : 0.0);
+#endif
+    size_t rss = resident_bytes();
+    if (rss)
+        report(1, "Resident: %zu bytes", rss);
+
+    last = now;
+    allocation_window();
+    return true;
+}
+
 static bool do_prev(int argc, char *argv[])
 {
     if (argc != 1) {
@@ -1056,40 +1230,104 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
-/* shuffle nodes in queue */
-bool q_shuffle(struct list_head *head)
+/* Fisher-Yates over an array of the elements, exchanging their values.
+ * Unlike relinking, this takes a side array and fails if it can not be had.
+ */
+static bool shuffle_values(struct list_head *head, int len)
 {
-    if (!head || list_empty(head) || list_is_singular(head))
-        return false;
-
-    int len = q_size(head), i = 0;
-    element_t **arr = malloc(len * sizeof(element_t));
+    element_t **arr = malloc(len * sizeof(element_t *));
     if (!arr)
         return false;
-    struct list_head *curr;
-    list_for_each(curr, head) {
-        arr[i++] = list_entry(curr, element_t, list);
-    }
+
+    int i = 0;
+    element_t *entry;
+    list_for_each_entry(entry, head, list)
+        arr[i++] = entry;
 
     for (int k = len - 1; k > 0; k--) {
-        int j = rand() % k;
-        // exchange the value pointer of arr[k] and arr[j]
+        int j = random_below(k + 1);
         char *tmp = arr[k]->value;
         arr[k]->value = arr[j]->value;
         arr[j]->value = tmp;
     }
 
     free(arr);
+    return true;
+}
 
+/* Shuffle the n nodes of a NULL terminated chain linked by next. Both halves
+ * are shuffled, then merged taking the next node from either side with
+ * probability proportional to the nodes it has left, which picks each
+ * interleaving equally often, so every order is as likely.
+ */
+static struct list_head *shuffle_chain(struct list_head *first, int n)
+{
+    if (n < 2)
+        return first;
+
+    int nl = n / 2, nr = n - nl;
+    struct list_head *mid = first;
+    for (int i = 1; i < nl; i++)
+        mid = mid->next;
+    struct list_head *right = shuffle_chain(mid->next, nr);
+    mid->next = NULL;
+    struct list_head *left = shuffle_chain(first, nl);
+
+    struct list_head *merged = NULL, **tail = &merged;
+    while (nl && nr) {
+        if (random_below(nl + nr) < (uint32_t) nl) {
+            *tail = left;
+            left = left->next;
+            nl--;
+        } else {
+            *tail = right;
+            right = right->next;
+            nr--;
+        }
+        tail = &(*tail)->next;
+    }
+    *tail = nl ? left : right;
+    return merged;
+}
+
+/* Shuffle by relinking the nodes, leaving the values where they are. Takes
+ * O(n log n) time and no memory besides the O(log n) deep recursion.
+ */
+static bool shuffle_nodes(struct list_head *head, int len)
+{
+    head->prev->next = NULL;
+    struct list_head *prev = head, *node = shuffle_chain(head->next, len);
+    for (; node; prev = node, node = node->next) {
+        prev->next = node;
+        node->prev = prev;
+    }
+    prev->next = head;
+    head->prev = prev;
     return true;
 }
 
+/* shuffle nodes in queue */
+bool q_shuffle(struct list_head *head)
+{
+    if (!head)
+        return false;
+    /* Nothing to shuffle, which is not an error */
+    if (list_empty(head) || list_is_singular(head))
+        return true;
+
+    int len = q_size(head);
+    return relink ? shuffle_nodes(head, len) : shuffle_values(head, len);
+}
+
 static bool do_shuffle(int argc, char *argv[])
 {
-    if (argc != 2) {
-        report(1, "Usage: shuffle <times>");
+    int n = 1;
+    if (argc > 3 || (argc > 1 && (!get_int(argv[1], &n) || n < 1)) ||
+        (argc == 3 && strcmp(argv[2], "each"))) {
+        report(1, "Usage: shuffle [N [each]]");
         return false;
     }
+    bool show_each = argc == 3;
 
     if (!current || !current->q) {
         report(3, "Warning: Calling shuffle on null queue");
@@ -1097,15 +1335,102 @@ static bool do_shuffle(int argc, char *argv[])
     }
     error_check();
 
-
-    int n = atoi(argv[1]);
-    for (int i = 0; i < n; i++) {
+    bool ok = true;
+    for (int i = 0; ok && i < n; i++) {
+        time_budget(0);
         if (exception_setup(true))
-            q_shuffle(current->q);
+            ok = q_shuffle(current->q);
         exception_cancel();
-        q_show(3);
+        if (!ok)
+            report(1, "ERROR: Failed to shuffle queue");
+        if (show_each && i < n - 1)
+            q_show(3);
     }
-    return 1;
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Time one size of a complexity sweep, within a budget scaled to it */
+static bool complexity_guard(bool (*measure)(void *arg),
+                             void *arg,
+                             size_t elements)
+{
+    bool ok = false;
+    set_time_elements(elements);
+    if (exception_setup(true))
+        ok = measure(arg);
+    exception_cancel();
+    return ok;
+}
+
+static bool do_complexity(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3) {
+        report(1, "Usage: complexity <op> [1|logn|n|nlogn|n2]");
+        return false;
+    }
+
+    cplx_class_t expect = N_CPLX;
+    if (argc == 3 && !cplx_parse(argv[2], &expect)) {
+        report(1, "Unknown complexity class '%s'", argv[2]);
+        return false;
+    }
+
+    /* Measured queues must not be disturbed by injected malloc failures, and
+     * are too big to be freed in cautious mode
+     */
+    int saved_fail_probability = fail_probability;
+    fail_probability = 0;
+    set_cautious_mode(false);
+
+    cplx_result_t res;
+    bool ok = cplx_measure(argv[1], expect, complexity_guard, &res);
+    set_cautious_mode(true);
+    fail_probability = saved_fail_probability;
+
+    if (!ok) {
+        report(1, "ERROR: Could not measure operation '%s'", argv[1]);
+        return false;
+    }
+
+    for (int i = 0; i < CPLX_N_SIZES; i++)
+        report(2, "  n = %-8lu %12.0f cycles", (unsigned long) res.n[i],
+               res.cycles[i]);
+    for (int c = 0; c < N_CPLX; c++)
+        report(3, "  %-12s residual %.4f", cplx_name(c), res.rss[c]);
+    report(1, "Estimated complexity of %s: %s (confidence %.0f%%, t ~ n^%.2f)",
+           argv[1], cplx_name(res.best), 100 * res.confidence, res.exponent);
+
+    if (expect != N_CPLX && res.best > expect) {
+        report(1, "ERROR: Expected %s or better", cplx_name(expect));
+        ok = false;
+    }
+
+    return ok && !error_check();
+}
+
+/* Describe current queue and the allocations made by the command */
+static void json_status(bool done)
+{
+    static alloc_stats_t before;
+    if (!done) {
+        allocation_stats(&before);
+        return;
+    }
+
+    alloc_stats_t after;
+    allocation_stats(&after);
+    if (current) {
+        json_field("queue", "%d", current->id);
+        json_field("size", "%d", current->size);
+    } else {
+        json_field("queue", "null");
+        json_field("size", "null");
+    }
+    json_field("allocs", "%zu", after.allocs - before.allocs);
+    json_field("frees", "%zu", after.frees - before.frees);
+    json_field("bytes", "%lld",
+               (long long) after.bytes - (long long) before.bytes);
 }
 
 static void console_init()
@@ -1122,6 +1447,10 @@ static void console_init()
                 "Insert string str at tail of queue n times. Generate random "
                 "string(s) if str equals RAND. (default: n == 1)",
                 "str [n]");
+    ADD_COMMAND(prefill,
+                "Insert n random strings at tail of queue without checking "
+                "each copy",
+                "n");
     ADD_COMMAND(
         rh,
         "Remove from head of queue. Optionally compare to expected value str",
@@ -1134,6 +1463,10 @@ static void console_init()
     ADD_COMMAND(sort, "Sort queue in ascending/descending order", "");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
+    ADD_COMMAND(mem,
+                "Show allocated and peak bytes, block sizes and resident "
+                "memory",
+                "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
@@ -1148,7 +1481,14 @@ static void console_init()
                 "");
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
-    ADD_COMMAND(shuffle, "Shuffle the nodes of the queue", "[N]");
+    ADD_COMMAND(shuffle,
+                "Shuffle the nodes of the queue N times, showing the result "
+                "of each round if requested (default: N == 1)",
+                "[N [each]]");
+    ADD_COMMAND(complexity,
+                "Estimate growth of op (ih, it, rh, rt, size, reverse, swap, "
+                "dm, sort, ascend, descend). Fail if worse than class",
+                "op [class]");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
@@ -1157,11 +1497,26 @@ static void console_init()
               "Number of times allow queue operations to return false", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
+    add_param("relink", &relink,
+              "Shuffle by relinking nodes instead of exchanging values", NULL);
+    add_param("alloc_profile", &alloc_profile,
+              "Number of allocating call sites to list on quit (0 for none)",
+              NULL);
+    add_param("time", &time_limit,
+              "Time limit of an operation in microseconds (0 for none)", NULL);
+    add_param("time_per_elem", &time_per_elem,
+              "Extra time allowed per element in nanoseconds", NULL);
+    add_param("time_report", &time_report,
+              "Report the time taken by each operation", NULL);
 }
 
 /* Signal handlers */
 static void sigsegv_handler(int sig)
 {
+    /* Output is buffered and would be lost on abort. Flushing it here is not
+     * async-signal-safe, but there is nothing left to corrupt.
+     */
+    report_flush();
     /* Avoid possible non-reentrant signal function be used in signal handler */
     assert(write(1,
                  "Segmentation fault occurred.  You dereferenced a NULL or "
@@ -1192,6 +1547,7 @@ static bool q_quit(int argc, char *argv[])
     if (current && current->size > BIG_LIST_SIZE)
         set_cautious_mode(false);
 
+    time_budget(0);
     if (exception_setup(true)) {
         struct list_head *cur = chain.head.next;
         while (chain.size > 0) {
@@ -1201,10 +1557,14 @@ static bool q_quit(int argc, char *argv[])
             free(qctx);
             chain.size--;
         }
+        /* The JSON status of quit must not look at the freed queues */
+        INIT_LIST_HEAD(&chain.head);
+        current = NULL;
     }
 
     exception_cancel();
     set_cautious_mode(true);
+    allocation_sites_report();
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -1218,9 +1578,11 @@ static bool q_quit(int argc, char *argv[])
 
 static void usage(char *cmd)
 {
-    printf("Usage: %s [-h] [-f FILE][-v LEVEL][-l LOG\n", cmd);
+    printf("Usage: %s [-h] [-j] [-f FILE][-b FILE][-v LEVEL][-l LOG\n", cmd);
     printf("\t-h         Print this information\n");
+    printf("\t-j         Print one JSON object per command\n");
     printf("\t-f FILE   Read commands from FILE\n");
+    printf("\t-b FILE   Replay binary trace FILE made by the record command\n");
     printf("\t-v LEVEL  Set verbosity level\n");
     printf("\t-l LOG    Echo results to LOG\n");
     exit(0);
@@ -1420,6 +1782,8 @@ uintptr_t os_random(uintptr_t seed)
 #define BUFSIZE 256
 int main(int argc, char *argv[])
 {
+    report_init();
+
     /* sanity check for git hook integration */
     if (!sanity_check())
         return -1;
@@ -1427,21 +1791,31 @@ int main(int argc, char *argv[])
     /* To hold input file name */
     char buf[BUFSIZE];
     char *infile_name = NULL;
+    char bbuf[BUFSIZE];
+    char *replay_name = NULL;
     char lbuf[BUFSIZE];
     char *logfile_name = NULL;
     int level = 4;
     int c;
 
-    while ((c = getopt(argc, argv, "hv:f:l:")) != -1) {
+    while ((c = getopt(argc, argv, "hjv:f:b:l:")) != -1) {
         switch (c) {
         case 'h':
             usage(argv[0]);
             break;
+        case 'j':
+            json_output = 1;
+            break;
         case 'f':
             strncpy(buf, optarg, BUFSIZE);
             buf[BUFSIZE - 1] = '\0';
             infile_name = buf;
             break;
+        case 'b':
+            strncpy(bbuf, optarg, BUFSIZE);
+            bbuf[BUFSIZE - 1] = '\0';
+            replay_name = bbuf;
+            break;
         case 'v': {
             char *endptr;
             errno = 0;
@@ -1474,7 +1848,7 @@ int main(int argc, char *argv[])
     console_init();
 
     /* Initialize linenoise only when infile_name not exist */
-    if (!infile_name) {
+    if (!infile_name && !replay_name) {
         /* Trigger call back function(auto completion) */
         line_set_completion_callback(completion);
 
@@ -1489,9 +1863,13 @@ int main(int argc, char *argv[])
         set_logfile(logfile_name);
 
     add_quit_helper(q_quit);
+    json_set_helper(json_status);
 
     bool ok = true;
-    ok = ok && run_console(infile_name);
+    if (replay_name)
+        ok = ok && run_replay(replay_name);
+    else
+        ok = ok && run_console(infile_name);
 
     /* Do finish_cmd() before check whether ok is true or false */
     ok = finish_cmd() && ok;
@@ -28,6 +28,9 @@
 #define _GNU_SOURCE
 #endif
 
+#include <stdbool.h>
+#include <string.h>
+
 #include "random.h"
 
 #if defined(__linux__) || defined(__GNU__)
@@ -272,7 +275,7 @@ static int bsd_randombytes(void *buf, size_t n)
 }
 #endif
 
-int randombytes(uint8_t *buf, size_t n)
+static int sys_randombytes(uint8_t *buf, size_t n)
 {
 #if defined(__linux__) || defined(__GNU__)
 #if defined(USE_GLIBC)
@@ -291,3 +294,185 @@ int randombytes(uint8_t *buf, size_t n)
 #error "randombytes(...) is not supported on this platform"
 #endif
 }
+
+/* Userspace generator: ChaCha20 keystream keyed from the kernel, served from
+ * a buffer so that most requests need no system call at all. Every refill
+ * replaces the key with the first bytes of the fresh keystream (fast key
+ * erasure), and bytes are wiped once handed out, so a later memory disclosure
+ * does not reveal earlier output. The kernel is asked for a new key after
+ * every RESEED_BYTES of output.
+ */
+#define CHACHA_BLOCK_SIZE 64
+#define CHACHA_KEY_SIZE 32
+#define RNG_BUF_SIZE (16 * CHACHA_BLOCK_SIZE)
+#define RESEED_BYTES (1 << 24)
+
+static struct {
+    uint8_t buf[RNG_BUF_SIZE];
+    size_t pos;    /* Next unread byte in buf */
+    size_t served; /* Bytes generated since last reseed */
+    uint32_t key[8];
+    bool seeded;
+} rng = {.pos = RNG_BUF_SIZE};
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define QUARTERROUND(a, b, c, d) \
+    a += b;                      \
+    d = ROTL32(d ^ a, 16);       \
+    c += d;                      \
+    b = ROTL32(b ^ c, 12);       \
+    a += b;                      \
+    d = ROTL32(d ^ a, 8);        \
+    c += d;                      \
+    b = ROTL32(b ^ c, 7)
+
+/* ChaCha20 block function as in RFC 8439, with a 64-bit block counter and an
+ * all-zero nonce since every key is used for a single buffer only.
+ */
+static void chacha20_block(const uint32_t key[8],
+                           uint64_t counter,
+                           uint8_t out[CHACHA_BLOCK_SIZE])
+{
+    const uint32_t in[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0],     key[1],     key[2],     key[3],
+        key[4],     key[5],     key[6],     key[7],
+        (uint32_t) counter, (uint32_t) (counter >> 32), 0, 0,
+    };
+    uint32_t x[16];
+    memcpy(x, in, sizeof(x));
+
+    for (int i = 0; i < 10; i++) {
+        QUARTERROUND(x[0], x[4], x[8], x[12]);
+        QUARTERROUND(x[1], x[5], x[9], x[13]);
+        QUARTERROUND(x[2], x[6], x[10], x[14]);
+        QUARTERROUND(x[3], x[7], x[11], x[15]);
+        QUARTERROUND(x[0], x[5], x[10], x[15]);
+        QUARTERROUND(x[1], x[6], x[11], x[12]);
+        QUARTERROUND(x[2], x[7], x[8], x[13]);
+        QUARTERROUND(x[3], x[4], x[9], x[14]);
+    }
+
+    for (int i = 0; i < 16; i++) {
+        uint32_t v = x[i] + in[i];
+        out[4 * i] = (uint8_t) v;
+        out[4 * i + 1] = (uint8_t) (v >> 8);
+        out[4 * i + 2] = (uint8_t) (v >> 16);
+        out[4 * i + 3] = (uint8_t) (v >> 24);
+    }
+}
+
+static int rng_refill(void)
+{
+    if (!rng.seeded || rng.served >= RESEED_BYTES) {
+        if (sys_randombytes((uint8_t *) rng.key, sizeof(rng.key)) != 0)
+            return -1;
+        rng.seeded = true;
+        rng.served = 0;
+    }
+
+    for (size_t i = 0; i < RNG_BUF_SIZE / CHACHA_BLOCK_SIZE; i++)
+        chacha20_block(rng.key, i, rng.buf + i * CHACHA_BLOCK_SIZE);
+
+    memcpy(rng.key, rng.buf, CHACHA_KEY_SIZE);
+    memset(rng.buf, 0, CHACHA_KEY_SIZE);
+    rng.pos = CHACHA_KEY_SIZE;
+    rng.served += RNG_BUF_SIZE - CHACHA_KEY_SIZE;
+    return 0;
+}
+
+int randombytes(uint8_t *buf, size_t n)
+{
+    while (n > 0) {
+        if (rng.pos == RNG_BUF_SIZE && rng_refill() != 0)
+            return -1;
+
+        size_t chunk = RNG_BUF_SIZE - rng.pos;
+        if (chunk > n)
+            chunk = n;
+        memcpy(buf, rng.buf + rng.pos, chunk);
+        memset(rng.buf + rng.pos, 0, chunk);
+        rng.pos += chunk;
+        buf += chunk;
+        n -= chunk;
+    }
+    return 0;
+}
+
+uint8_t randombit(void)
+{
+    /* Hand out the bits of one word before asking for the next */
+    static uint64_t bits;
+    static int nbits = 0;
+
+    if (nbits == 0) {
+        randombytes((uint8_t *) &bits, sizeof(bits));
+        nbits = 64;
+    }
+    uint8_t ret = bits & 1;
+    bits >>= 1;
+    nbits--;
+    return ret;
+}
+
+/* xoshiro256** by David Blackman and Sebastiano Vigna, see:
+ * <https://prng.di.unimi.it/xoshiro256starstar.c>
+ */
+static uint64_t xs[4];
+static bool xs_seeded = false;
+
+#define ROTL64(v, n) (((v) << (n)) | ((v) >> (64 - (n))))
+
+void random_seed(uint64_t seed)
+{
+    /* Expand seed through splitmix64 as recommended by the authors, which
+     * also keeps the state from being all zeros.
+     */
+    for (int i = 0; i < 4; i++) {
+        seed += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        xs[i] = z ^ (z >> 31);
+    }
+    xs_seeded = true;
+}
+
+uint64_t random_next(void)
+{
+    if (!xs_seeded) {
+        uint64_t seed = 0;
+        randombytes((uint8_t *) &seed, sizeof(seed));
+        random_seed(seed);
+    }
+
+    const uint64_t result = ROTL64(xs[1] * 5, 7) * 9;
+    const uint64_t t = xs[1] << 17;
+    xs[2] ^= xs[0];
+    xs[3] ^= xs[1];
+    xs[1] ^= xs[2];
+    xs[0] ^= xs[3];
+    xs[2] ^= t;
+    xs[3] = ROTL64(xs[3], 45);
+    return result;
+}
+
+/* Lemire's nearly divisionless method: the high half of x * range is uniform
+ * once the few x whose low half falls below 2^32 % range are rejected, and
+ * the division computing that threshold is only needed when the low half is
+ * below range in the first place.
+ */
+uint32_t random_below(uint32_t range)
+{
+    uint64_t m = (random_next() >> 32) * range;
+    uint32_t low = (uint32_t) m;
+    if (low < range) {
+        const uint32_t threshold = -range % range;
+        while (low < threshold) {
+            m = (random_next() >> 32) * range;
+            low = (uint32_t) m;
+        }
+    }
+    return m >> 32;
+}
@@ -4,14 +4,22 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Fill buf with len bytes from a userspace CSPRNG seeded by the kernel.
+ * Return 0 on success.
+ */
 extern int randombytes(uint8_t *buf, size_t len);
 
-static inline uint8_t randombit(void)
-{
-    uint8_t ret = 0;
-    randombytes(&ret, 1);
-    return ret & 1;
-}
+/* Return a single random bit */
+extern uint8_t randombit(void);
+
+/* Fast non-cryptographic generator, xoshiro256**. It seeds itself from
+ * randombytes on first use, unless random_seed was called before.
+ */
+extern void random_seed(uint64_t seed);
+extern uint64_t random_next(void);
+
+/* Return uniformly distributed integer in [0, range), range > 0 */
+extern uint32_t random_below(uint32_t range);
 
 #if INTPTR_MAX == INT64_MAX
 #define M_INTPTR_SHIFT (3)
@@ -18,6 +18,13 @@ static FILE *errfile = NULL;
 static FILE *verbfile = NULL;
 static FILE *logfile = NULL;
 
+/* Output is fully buffered and only written out by report_flush, which the
+ * console calls once per command, rather than flushed after every message
+ */
+#define OUT_BUF_SIZE (1 << 20)
+static char verb_buf[OUT_BUF_SIZE];
+static char log_buf[OUT_BUF_SIZE];
+
 int verblevel = 0;
 static void init_files(FILE *efile, FILE *vfile)
 {
@@ -25,6 +32,12 @@ static void init_files(FILE *efile, FILE *vfile)
     verbfile = vfile;
 }
 
+void report_init(void)
+{
+    init_files(stdout, stdout);
+    setvbuf(verbfile, verb_buf, _IOFBF, sizeof(verb_buf));
+}
+
 static char fail_buf[1024] = "FATAL Error.  Exiting\n";
 
 static volatile int ret = 0;
@@ -32,6 +45,7 @@ static volatile int ret = 0;
 /* Default fatal function */
 static void default_fatal_fun()
 {
+    report_flush();
     ret = write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
     if (logfile)
         fputs(fail_buf, logfile);
@@ -48,9 +62,142 @@ void set_verblevel(int level)
 bool set_logfile(const char *file_name)
 {
     logfile = fopen(file_name, "w");
+    if (logfile)
+        setvbuf(logfile, log_buf, _IOFBF, sizeof(log_buf));
     return logfile != NULL;
 }
 
+void report_flush(void)
+{
+    if (verbfile)
+        fflush(verbfile);
+    if (logfile)
+        fflush(logfile);
+}
+
+/* JSON Lines output. While a command runs, whatever it reports is collected
+ * instead of printed, and once it completes a single object describing it is
+ * written to the output stream. Messages reported between commands, such as
+ * echoed command lines, are left out.
+ */
+int json_output = 0;
+
+typedef struct {
+    char *buf;
+    size_t len, size;
+} text_t;
+
+static bool json_active = false;
+static const char *json_cmd;
+static text_t json_out, json_err, json_fields;
+static void (*json_helper)(bool done) = NULL;
+
+static void text_vappend(text_t *t, const char *fmt, va_list ap)
+{
+    va_list ap2;
+    va_copy(ap2, ap);
+    int n = vsnprintf(NULL, 0, fmt, ap2);
+    va_end(ap2);
+    if (n < 0)
+        return;
+
+    if (t->len + n + 1 > t->size) {
+        size_t size = t->size ? t->size : 256;
+        while (size < t->len + n + 1)
+            size *= 2;
+        char *buf = realloc(t->buf, size);
+        if (!buf)
+            return;
+        t->buf = buf;
+        t->size = size;
+    }
+    vsnprintf(t->buf + t->len, t->size - t->len, fmt, ap);
+    t->len += n;
+}
+
+static void text_append(text_t *t, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    text_vappend(t, fmt, ap);
+    va_end(ap);
+}
+
+/* Write len bytes of s as JSON string */
+static void json_string(FILE *f, const char *s, size_t len)
+{
+    putc('"', f);
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+            fprintf(f, "\\%c", c);
+        else if (c == '\n')
+            fputs("\\n", f);
+        else if (c < 0x20)
+            fprintf(f, "\\u%04x", c);
+        else
+            putc(c, f);
+    }
+    putc('"', f);
+}
+
+/* Collected text as JSON string, or null if there is none */
+static void json_text(FILE *f, const text_t *t)
+{
+    if (t->len)
+        json_string(f, t->buf, t->len);
+    else
+        fputs("null", f);
+}
+
+void json_set_helper(void (*helper)(bool done))
+{
+    json_helper = helper;
+}
+
+void json_field(const char *key, const char *fmt, ...)
+{
+    if (!json_active)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    text_append(&json_fields, ",\"%s\":", key);
+    text_vappend(&json_fields, fmt, ap);
+    va_end(ap);
+}
+
+void json_begin(const char *cmd)
+{
+    json_cmd = cmd;
+    json_out.len = json_err.len = json_fields.len = 0;
+    json_active = true;
+    if (json_helper)
+        json_helper(false);
+}
+
+void json_end(bool ok, long long ns)
+{
+    if (!json_active)
+        return;
+    if (json_helper)
+        json_helper(true);
+    json_active = false;
+
+    if (!verbfile)
+        init_files(stdout, stdout);
+    fputs("{\"cmd\":", verbfile);
+    json_string(verbfile, json_cmd, strlen(json_cmd));
+    fprintf(verbfile, ",\"ok\":%s,\"ns\":%lld", ok ? "true" : "false", ns);
+    if (json_fields.len)
+        fwrite(json_fields.buf, 1, json_fields.len, verbfile);
+    fputs(",\"output\":", verbfile);
+    json_text(verbfile, &json_out);
+    fputs(",\"error\":", verbfile);
+    json_text(verbfile, &json_err);
+    fputs("}\n", verbfile);
+}
+
 void report_event(message_t msg, char *fmt, ...)
 {
     va_list ap;
@@ -71,12 +218,21 @@ void report_event(message_t msg, char *fmt, ...)
     if (!errfile)
         init_files(stdout, stdout);
 
-    va_start(ap, fmt);
-    fprintf(errfile, "%s: ", msg_name);
-    vfprintf(errfile, fmt, ap);
-    fprintf(errfile, "\n");
-    fflush(errfile);
-    va_end(ap);
+    if (json_active) {
+        text_append(&json_err, "%s: ", msg_name);
+        va_start(ap, fmt);
+        text_vappend(&json_err, fmt, ap);
+        va_end(ap);
+        text_append(&json_err, "\n");
+        if (fatal)
+            json_end(false, -1);
+    } else if (!json_output) {
+        va_start(ap, fmt);
+        fprintf(errfile, "%s: ", msg_name);
+        vfprintf(errfile, fmt, ap);
+        fprintf(errfile, "\n");
+        va_end(ap);
+    }
 
     if (logfile) {
         va_start(ap, fmt);
@@ -96,37 +252,42 @@ void report_event(message_t msg, char *fmt, ...)
 }
 
 #define BUF_SIZE 4096
-extern int web_connfd;
 void report(int level, char *fmt, ...)
 {
     if (!verbfile)
         init_files(stdout, stdout);
 
-    char buffer[BUF_SIZE];
     if (level <= verblevel) {
+        char buffer[BUF_SIZE];
         va_list ap;
         va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fprintf(verbfile, "\n");
-        fflush(verbfile);
+        if (json_active) {
+            /* Errors are told apart by the prefix used throughout qtest */
+            text_t *t = strncmp(fmt, "ERROR", 5) ? &json_out : &json_err;
+            text_vappend(t, fmt, ap);
+            text_append(t, "\n");
+        } else if (!json_output) {
+            vfprintf(verbfile, fmt, ap);
+            fprintf(verbfile, "\n");
+        }
         va_end(ap);
 
         if (logfile) {
             va_start(ap, fmt);
             vfprintf(logfile, fmt, ap);
             fprintf(logfile, "\n");
-            fflush(logfile);
             va_end(ap);
         }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
-    }
-    if (web_connfd) {
-        int len = strlen(buffer);
-        buffer[len] = '\n';
-        buffer[len + 1] = '\0';
-        web_send(web_connfd, buffer);
+        if (web_connfd) {
+            /* Leave room for the newline */
+            va_start(ap, fmt);
+            vsnprintf(buffer, BUF_SIZE - 1, fmt, ap);
+            va_end(ap);
+            int len = strlen(buffer);
+            buffer[len] = '\n';
+            buffer[len + 1] = '\0';
+            web_send(web_connfd, buffer);
+        }
     }
 }
 
@@ -135,27 +296,28 @@ void report_noreturn(int level, char *fmt, ...)
     if (!verbfile)
         init_files(stdout, stdout);
 
-    char buffer[BUF_SIZE];
     if (level <= verblevel) {
+        char buffer[BUF_SIZE];
         va_list ap;
         va_start(ap, fmt);
-        vfprintf(verbfile, fmt, ap);
-        fflush(verbfile);
+        if (json_active)
+            text_vappend(&json_out, fmt, ap);
+        else if (!json_output)
+            vfprintf(verbfile, fmt, ap);
         va_end(ap);
 
         if (logfile) {
             va_start(ap, fmt);
             vfprintf(logfile, fmt, ap);
-            fflush(logfile);
             va_end(ap);
         }
-        va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
-        va_end(ap);
+        if (web_connfd) {
+            va_start(ap, fmt);
+            vsnprintf(buffer, BUF_SIZE, fmt, ap);
+            va_end(ap);
+            web_send(web_connfd, buffer);
+        }
     }
-
-    if (web_connfd)
-        web_send(web_connfd, buffer);
 }
 
 /* Functions denoting failures */
@@ -166,7 +328,8 @@ static void fail_fun(const char *format, const char *msg)
     snprintf(fail_buf, sizeof(fail_buf), format, msg);
     /* Tack on return */
     fail_buf[strlen(fail_buf)] = '\n';
-    /* Use write to avoid any buffering issues */
+    /* Use write to avoid any buffering issues, once what came before is out */
+    report_flush();
     ret = write(STDOUT_FILENO, fail_buf, strlen(fail_buf) + 1);
 
     if (logfile) {
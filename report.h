@@ -12,6 +12,9 @@ typedef enum { MSG_WARN, MSG_ERROR, MSG_FATAL, N_MSG } message_t;
 /* Buffer sizes */
 #define MAX_CHAR 512
 
+/* Set up buffered output. Call before anything is written to stdout */
+void report_init(void);
+
 bool set_logfile(const char *file_name);
 
 extern int verblevel;
@@ -26,6 +29,26 @@ void report(int verblevel, char *fmt, ...);
 /* Like report, but without return character */
 void report_noreturn(int verblevel, char *fmt, ...);
 
+/* Write out buffered output of report and friends */
+void report_flush(void);
+
+/* Print one JSON object per command instead of free-form text */
+extern int json_output;
+
+/* Start collecting output of command cmd */
+void json_begin(const char *cmd);
+
+/* Add "key": value to object of current command, value formatted by fmt */
+void json_field(const char *key, const char *fmt, ...);
+
+/* Set function called by json_begin, then by json_end with done set to add
+ * fields of its own to the object
+ */
+void json_set_helper(void (*helper)(bool done));
+
+/* Print object for current command, which took ns nanoseconds */
+void json_end(bool ok, long long ns);
+
 /* Attempt to call malloc.  Fail when returns NULL */
 void *malloc_or_fail(size_t bytes, const char *fun_name);
 
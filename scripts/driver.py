@@ -1,9 +1,16 @@
 #!/usr/bin/env python3
 
 from __future__ import print_function
+import json
+import os
+import resource
+import statistics
 import subprocess
 import sys
 import getopt
+import tempfile
+import time
+from concurrent.futures import ThreadPoolExecutor
 
 
 
@@ -17,6 +24,7 @@ class Tracer:
     autograde = False
     useValgrind = False
     colored = False
+    jobs = 1
 
     traceDict = {
         1: "trace-01-ops",
@@ -35,7 +43,16 @@ class Tracer:
         14: "trace-14-perf",
         15: "trace-15-perf",
         16: "trace-16-perf",
-        17: "trace-17-complexity"
+        17: "trace-17-complexity",
+        18: "trace-18-shuffle",
+        19: "trace-19-console",
+        20: "trace-20-record",
+        21: "trace-21-replay",
+        22: "trace-22-loop",
+        23: "trace-23-stats",
+        24: "trace-24-mem",
+        25: "trace-25-alloc-profile",
+        26: "trace-26-growth"
     }
 
     traceProbs = {
@@ -55,10 +72,25 @@ class Tracer:
         14: "Trace-14",
         15: "Trace-15",
         16: "Trace-16",
-        17: "Trace-17"
+        17: "Trace-17",
+        18: "Trace-18",
+        19: "Trace-19",
+        20: "Trace-20",
+        21: "Trace-21",
+        22: "Trace-22",
+        23: "Trace-23",
+        24: "Trace-24",
+        25: "Trace-25",
+        26: "Trace-26"
     }
 
-    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
+    perfTraces = [14, 15, 16]
+
+    # Traces whose recorded binary traces must replay to the same output
+    replayTraces = [20, 21]
+
+    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+                 5, 5, 5, 5, 5, 5, 5, 5, 5, 5]
 
     RED = '\033[91m'
     GREEN = '\033[92m'
@@ -69,39 +101,161 @@ class Tracer:
                  verbLevel=0,
                  autograde=False,
                  useValgrind=False,
-                 colored=False):
+                 colored=False,
+                 jobs=1):
         if qtest != "":
             self.qtest = qtest
         self.verbLevel = verbLevel
         self.autograde = autograde
         self.useValgrind = useValgrind
         self.colored = colored
+        self.jobs = max(jobs, 1)
 
     def printInColor(self, text, color):
         if self.colored == False:
             color = self.WHITE
         print(color, text, self.WHITE, sep = '')
 
-    def runTrace(self, tid):
+    # Run a trace and return (ok, output, error, seconds, CPU seconds, peak
+    # RSS in KB). The output of qtest is only collected when capture is set,
+    # so that traces running side by side can be printed one after another.
+    def runTrace(self, tid, capture=False):
         if not tid in self.traceDict:
-            self.printInColor("ERROR: No trace with id %d" % tid, self.RED)
-            return False
+            return (False, b"", "ERROR: No trace with id %d" % tid, 0, 0, 0)
         fname = "%s/%s.cmd" % (self.traceDirectory, self.traceDict[tid])
         vname = "%d" % self.verbLevel
         clist = self.command + ["-v", vname, "-f", fname]
 
+        start = time.time()
+        out = tempfile.TemporaryFile() if capture else None
         try:
-            retcode = subprocess.call(clist)
+            proc = subprocess.Popen(clist, stdout=out, stderr=out)
         except Exception as e:
-            self.printInColor("Call of '%s' failed: %s" % (" ".join(clist), e), self.RED)
-            return False
-        return retcode == 0
+            error = "Call of '%s' failed: %s" % (" ".join(clist), e)
+            return (False, b"", error, 0, 0, 0)
+        # Reap it here rather than through proc.wait(), to get its rusage
+        _, status, usage = os.wait4(proc.pid, 0)
+        seconds = time.time() - start
+        if os.WIFSIGNALED(status):
+            proc.returncode = -os.WTERMSIG(status)
+        else:
+            proc.returncode = os.WEXITSTATUS(status)
+        output = b""
+        if out:
+            out.seek(0)
+            output = out.read()
+            out.close()
+        ok = proc.returncode == 0
+        error = None
+        if ok and tid in self.replayTraces:
+            ok, error = self.checkReplay(tid)
+        return (ok, output, error, seconds,
+                usage.ru_utime + usage.ru_stime, usage.ru_maxrss)
+
+    # Output of qtest given the arguments, or None if it failed
+    def qtestOutput(self, args):
+        proc = subprocess.run([self.qtest, "-v", "3"] + args,
+                              stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        return proc.stdout if proc.returncode == 0 else None
+
+    # Record the commands of a trace into a binary trace, and check that
+    # replaying it, as well as the binary trace committed next to it if there
+    # is one, gives the same output as running the commands. Return (ok,
+    # error).
+    def checkReplay(self, tid):
+        tname = self.traceDict[tid]
+        fname = "%s/%s.cmd" % (self.traceDirectory, tname)
+        expected = self.qtestOutput(["-f", fname])
+        with tempfile.TemporaryDirectory() as tmp:
+            recorded = os.path.join(tmp, "trace.bin")
+            script = os.path.join(tmp, "record.cmd")
+            with open(script, "w") as f:
+                f.write("record %s\nsource %s\nrecord\n" % (recorded, fname))
+            if self.qtestOutput(["-f", script]) is None:
+                return (False, "ERROR: Could not record %s" % fname)
+            bins = [recorded]
+            committed = "%s/%s.bin" % (self.traceDirectory, tname)
+            if os.path.exists(committed):
+                bins.append(committed)
+            for bname in bins:
+                if self.qtestOutput(["-b", bname]) != expected:
+                    what = bname if bname == committed else "its recording"
+                    return (False, "ERROR: Replay of %s differs from %s" %
+                            (what, fname))
+        return (True, None)
+
+    def printSummary(self, stats, elapsed):
+        # A child starts out with the peak RSS of this script, which it was
+        # spawned from, so a peak below that is only known to be below it.
+        floor = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+        print("---\tTrace\t\t\tTime\tCPU\tPeak RSS")
+        for (tname, seconds, cpu, rss) in stats:
+            print("---\t%s\t%6.2fs\t%6.2fs\t%s%6d KB" %
+                  (tname.ljust(20), seconds, cpu, "<" if rss <= floor else " ",
+                   rss))
+        print("---\tElapsed %.2fs, %.2fs spent in traces" %
+              (elapsed, sum(s[1] for s in stats)))
+
+    # Run each perf trace the given number of rounds and compare the median
+    # CPU time with the one in the baseline file, which is written instead
+    # when it does not exist yet or when save is set. A trace regresses when
+    # it got slower by more than threshold percent and by more than three
+    # times the spread of the two measurements.
+    def bench(self, rounds, baseline, save, threshold):
+        self.command = [self.qtest]
+        old = None
+        if not save and os.path.exists(baseline):
+            with open(baseline) as f:
+                old = json.load(f)["traces"]
+        results = {}
+        regressed = False
+        print("---\tTrace\t\t\tMedian\tSpread\tBaseline\tDelta")
+        for t in self.perfTraces:
+            tname = self.traceDict[t]
+            samples = []
+            for _ in range(rounds):
+                ok, output, error, seconds, cpu, rss = self.runTrace(t, True)
+                if not ok:
+                    getattr(sys.stdout, "buffer", sys.stdout).write(output)
+                    self.printInColor(error or "---\t%s failed" % tname,
+                                      self.RED)
+                    sys.exit(1)
+                samples.append(cpu)
+            median = statistics.median(samples)
+            spread = statistics.median(abs(x - median) for x in samples)
+            results[tname] = {
+                "median": round(median, 6),
+                "spread": round(spread, 6)
+            }
+            line = "---\t%s\t%6.3fs\t%6.3fs" % (tname.ljust(20), median,
+                                                 spread)
+            if not old or tname not in old:
+                print(line)
+                continue
+            base = old[tname]
+            delta = (median - base["median"]) / max(base["median"], 1e-6)
+            noise = 3 * (spread + base["spread"]) / max(base["median"], 1e-6)
+            line += "\t%6.3fs\t\t%+.1f%%" % (base["median"], delta * 100)
+            if delta * 100 > threshold and delta > noise:
+                regressed = True
+                self.printInColor(line + " REGRESSION", self.RED)
+            elif delta * 100 > threshold:
+                print(line + " (within noise of %.1f%%)" % (noise * 100))
+            else:
+                self.printInColor(line, self.GREEN)
+        if old is None:
+            with open(baseline, "w") as f:
+                json.dump({"rounds": rounds, "traces": results}, f, indent=2)
+                f.write("\n")
+            print("---\tBaseline saved to %s" % baseline)
+        if regressed:
+            sys.exit(1)
 
     def run(self, tid=0):
         scoreDict = {k: 0 for k in self.traceDict.keys()}
         print("---\tTrace\t\tPoints")
         if tid == 0:
-            tidList = self.traceDict.keys()
+            tidList = list(self.traceDict.keys())
         else:
             if not tid in self.traceDict:
                 self.printInColor("ERROR: Invalid trace ID %d" % tid, self.RED)
@@ -113,11 +267,25 @@ class Tracer:
             self.command = ['valgrind', self.qtest]
         else:
             self.command = [self.qtest]
-        for t in tidList:
+        start = time.time()
+        stats = []
+        if self.jobs > 1:
+            pool = ThreadPoolExecutor(max_workers=self.jobs)
+            pending = [pool.submit(self.runTrace, t, True) for t in tidList]
+        for i, t in enumerate(tidList):
             tname = self.traceDict[t]
             if self.verbLevel > 0:
                 print("+++ TESTING trace %s:" % tname)
-            ok = self.runTrace(t)
+            if self.jobs > 1:
+                ok, output, error, seconds, cpu, rss = pending[i].result()
+                sys.stdout.flush()
+                getattr(sys.stdout, "buffer", sys.stdout).write(output)
+                sys.stdout.flush()
+            else:
+                ok, output, error, seconds, cpu, rss = self.runTrace(t)
+            if error:
+                self.printInColor(error, self.RED)
+            stats.append((tname, seconds, cpu, rss))
             maxval = self.maxScores[t]
             tval = maxval if ok else 0
             if tval < maxval:
@@ -131,6 +299,9 @@ class Tracer:
             self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.RED)
         else:
             self.printInColor("---\tTOTAL\t\t%d/%d" % (score, maxscore), self.GREEN)
+        if self.jobs > 1:
+            pool.shutdown()
+        self.printSummary(stats, time.time() - start)
         if self.autograde:
             # Generate JSON string
             jstring = '{"scores": {'
@@ -145,11 +316,21 @@ class Tracer:
         if score < maxscore:
             sys.exit(1)
 
+BASELINE = ".perf-baseline.json"
+THRESHOLD = 10
+
+
 def usage(name):
-    print("Usage: %s [-h] [-p PROG] [-t TID] [-v LEVEL] [--valgrind] [-c]" % name)
+    print("Usage: %s [-h] [-p PROG] [-t TID] [-v LEVEL] [-j N] [--valgrind] [-c]" % name)
     print("  -h        Print this message")
     print("  -p PROG   Program to test")
     print("  -t TID    Trace ID to test")
+    print("  -j N      Run up to N traces at once")
+    print("  --bench=ROUNDS      Time the perf traces against a baseline")
+    print("  --baseline=FILE     Baseline file (default %s)" % BASELINE)
+    print("  --save-baseline     Replace the baseline with this run")
+    print("  --threshold=PCT     Slowdown that fails the run (default %d)"
+          % THRESHOLD)
     print("  -v LEVEL  Set verbosity level (0-3)")
     print("  -c Enable colored text")
     sys.exit(0)
@@ -163,8 +344,15 @@ def run(name, args):
     autograde = False
     useValgrind = False
     colored = False
+    jobs = 1
+    rounds = 0
+    baseline = BASELINE
+    save = False
+    threshold = THRESHOLD
 
-    optlist, args = getopt.getopt(args, 'hp:t:v:A:c', ['valgrind'])
+    optlist, args = getopt.getopt(args, 'hp:t:v:A:cj:', [
+        'valgrind', 'bench=', 'baseline=', 'save-baseline', 'threshold='
+    ])
     for (opt, val) in optlist:
         if opt == '-h':
             usage(name)
@@ -181,6 +369,16 @@ def run(name, args):
             useValgrind = True
         elif opt == '-c':
             colored = True
+        elif opt == '-j':
+            jobs = int(val)
+        elif opt == '--bench':
+            rounds = int(val)
+        elif opt == '--baseline':
+            baseline = val
+        elif opt == '--save-baseline':
+            save = True
+        elif opt == '--threshold':
+            threshold = float(val)
         else:
             print("Unrecognized option '%s'" % opt)
             usage(name)
@@ -190,8 +388,12 @@ def run(name, args):
                verbLevel=vlevel,
                autograde=autograde,
                useValgrind=useValgrind,
-               colored=colored)
-    t.run(tid)
+               colored=colored,
+               jobs=jobs)
+    if rounds > 0:
+        t.bench(rounds, baseline, save, threshold)
+    else:
+        t.run(tid)
 
 
 if __name__ == "__main__":
@@ -7,6 +7,7 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <inttypes.h>
 #include <math.h>
 #include <mqueue.h>
@@ -25,6 +26,10 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 /* Remove C escape sequences */
 #define OPT_ESCAPE_STRIP (0x00000001)
 
@@ -80,6 +85,15 @@ static const char *dictionary_paths[] = {
     "scripts/aspell-pws",
 };
 
+/* Precompiled dictionary, used when it is newer than the word lists */
+#define DICT_DEFAULT_PATH ".fmtscan.dict"
+#define DICT_MAGIC "fmtdict"
+#define DICT_VERSION 2
+
+/* Findings of files, reused for those that did not change since */
+#define CACHE_MAGIC "fmtcach"
+#define CACHE_VERSION 2
+
 /* token types used for parsing C source code */
 typedef enum {
     TOKEN_UNKNOWN,        /* Token not recognized */
@@ -111,18 +125,71 @@ typedef struct {
     token_type_t type; /* Inferred token type */
 } token_t;
 
+/* Hash table entry for tokens (forms a linked list). */
+typedef struct hash_entry {
+    struct hash_entry *next;
+    char token[0]; /* Flexible array member for token data */
+} hash_entry_t;
+
+/* Findings of one file as kept in the cache. The data holds the path and
+ * then the bad spellings, each terminated by '\0' and repeated as often as
+ * they were found.
+ */
+typedef struct cache_entry {
+    struct cache_entry *next;     /* Next entry in the same bucket */
+    struct cache_entry *run_next; /* Next entry to write back */
+    bool kept;                    /* Whether the entry is written back */
+    int64_t size;
+    int64_t mtime;
+    uint64_t hash; /* Hash of the contents */
+    uint32_t lines;
+    uint32_t n_words;
+    uint32_t words_len;
+    char *words;
+    char data[0];
+} cache_entry_t;
+
+/* Record of an entry in the cache file, followed by its data */
+typedef struct {
+    int64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    uint32_t lines;
+    uint32_t n_words;
+    uint32_t path_len;
+    uint32_t words_len;
+} cache_record_t;
+
+/* Parser thread, with token buffers and findings of its own. The findings of
+ * all of them are merged once every file is parsed.
+ */
+typedef struct {
+    pthread_t pthread;
+    mqd_t mq;
+    token_t t, line, str;
+    uint32_t lines;
+    uint32_t bad_spellings;
+    uint32_t bad_spellings_total;
+    hash_entry_t *hash_bad_spellings[TABLE_SIZE];
+    /* Bad spellings of the file being parsed, for the cache */
+    char *file_words;
+    size_t file_words_len, file_words_size;
+    uint32_t file_n_words;
+    cache_entry_t *kept; /* Cache entries of the files parsed */
+} worker_t;
+
 typedef void (*parse_func_t)(const char *restrict path,
                              unsigned char *restrict data,
                              unsigned char *restrict data_end,
-                             token_t *restrict t,
-                             token_t *restrict line,
-                             token_t *restrict str);
+                             worker_t *restrict w);
 
 typedef uint16_t get_char_t;
 
 typedef struct {
     void *data;
     size_t size;
+    int64_t mtime;
+    cache_entry_t *cached; /* Entry of unchanged file, which is not mapped */
     parse_func_t parse_func;
     char filename[PATH_MAX];
 } msg_t;
@@ -130,6 +197,7 @@ typedef struct {
 typedef struct {
     char *path;
     mqd_t mq;
+    int workers;
 } context_t;
 
 /* Parser state context. */
@@ -138,14 +206,9 @@ typedef struct {
     unsigned char *data;     /* Start of the data */
     unsigned char *data_end; /* End of the data */
     bool skip_white_space;   /* Flag to skip whitespace characters */
+    uint32_t lines;          /* Lines seen so far */
 } parser_t;
 
-/* Hash table entry for tokens (forms a linked list). */
-typedef struct hash_entry {
-    struct hash_entry *next;
-    char token[0]; /* Flexible array member for token data */
-} hash_entry_t;
-
 typedef get_char_t (*get_token_action_t)(parser_t *restrict p,
                                          token_t *restrict t,
                                          get_char_t ch);
@@ -165,10 +228,46 @@ typedef struct word_node {
     bool eow; /* Flag indicating the end of a word */
 } word_node_t;
 
+/* Words are looked up in a double-array trie, built from the tree of
+ * word_node_t once all words are added. The child of node s for symbol c is
+ * node t = base(s) + c, provided that check(t) == s. Eight bytes per node,
+ * packed tightly, take far less memory and cache than 27 child indices.
+ */
+#define DA_ROOT 1
+#define DA_EOW 0x80000000U /* Flag in base indicating the end of a word */
+
+typedef struct {
+    uint32_t base;  /* Offset of children, and DA_EOW */
+    uint32_t check; /* Parent node, 0 for the root and free nodes */
+} da_node_t;
+
+typedef struct {
+    da_node_t *nodes;
+    uint32_t size;
+} dict_t;
+
+/* Header of a precompiled dictionary, which is followed by the nodes of the
+ * dictionary tree as they are laid out in memory, so that the file is mapped
+ * and used as is. The word lists it was built from are recorded to tell
+ * whether it is stale.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t node_size; /* sizeof(da_node_t) of the tool that built it */
+    uint32_t nodes;
+    uint32_t words;
+    uint32_t dict_size;
+    uint32_t sources;
+    struct {
+        int64_t size;
+        int64_t mtime;
+    } source[ARRAY_SIZE(dictionary_paths)];
+} dict_header_t;
+
 static uint64_t bytes_total;
 static uint32_t files;
 static uint32_t lines;
-static uint32_t lineno;
 static uint32_t bad_spellings;
 static uint32_t bad_spellings_total;
 static uint32_t words;
@@ -182,19 +281,33 @@ static char space[] = " ";
 static bool is_not_whitespace[256] ALIGNED(64);
 static bool is_not_identifier[256] ALIGNED(64);
 
-/* Flat array representing the dictionary words tree. */
-static word_node_t word_node_heap[WORD_NODES_HEAP_SIZE];
-static word_node_t *word_nodes = &word_node_heap[0];
-static word_node_t *word_node_heap_next = &word_node_heap[1];
+/* Flat array representing the dictionary words tree while it is built. */
+static word_node_t *word_node_heap;
+static word_node_t *word_node_heap_next;
+
+/* Dictionary looked up, built or mapped from a precompiled one */
+static dict_t word_dict;
 
 /* Flat array representing the tree of printf-like function names. */
-static word_node_t printf_node_heap[PRINTK_NODES_HEAP_SIZE];
-static word_node_t *printf_nodes = &printf_node_heap[0];
-static word_node_t *printf_node_heap_next = &printf_node_heap[1];
+static word_node_t *printf_node_heap;
+static word_node_t *printf_node_heap_next;
+static dict_t printf_dict;
+
+/* Words looked up in the dictionary, kept to benchmark find_word() */
+static bool bench;
+static char *bench_words;
+static size_t bench_words_len, bench_words_size;
 
-/* Hash table storing misspelled words. */
+/* Hash table storing misspelled words of all parser threads. */
 static hash_entry_t *hash_bad_spellings[TABLE_SIZE];
 
+static worker_t *workers;
+static int n_workers;
+
+/* Cache read at startup, looked up by path */
+static const char *cache_path;
+static cache_entry_t *cache_table[TABLE_SIZE];
+
 /* printf format specifiers. */
 static format_t formats[] ALIGNED(64) = {
     {"%", 1},     {"s", 1},    {"llu", 3},  {"lld", 3},  {"llx", 3},
@@ -268,7 +381,7 @@ static inline uint64_t hash_ror_uint64(const uint64_t x, const uint32_t bits)
  * each 64-bit segment from the string and performing a partial right rotation
  * to mix the bits back into the hash.
  */
-static uint32_t stress_hash_mulxror64(const char *str, const size_t len)
+static uint64_t hash_mulxror64(const char *str, const size_t len)
 {
     uint64_t hash = len;
 
@@ -280,13 +393,41 @@ static uint32_t stress_hash_mulxror64(const char *str, const size_t len)
         hash *= v;
         hash ^= hash_ror_uint64(hash, 40);
     }
-    for (size_t i = len & 7; *str && i; i--) {
+    for (size_t i = len & 7; i && *str; i--) {
         hash *= (uint8_t) *str++;
         hash ^= hash_ror_uint64(hash, 5);
     }
+    return hash;
+}
+
+static uint32_t stress_hash_mulxror64(const char *str, const size_t len)
+{
+    uint64_t hash = hash_mulxror64(str, len);
+
     return (uint32_t) ((hash >> 32) ^ hash) & HASH_MASK;
 }
 
+/* Hash of file contents, telling whether a cached file changed. Every word is
+ * mixed into the state by a bijection, so files differing in a single word,
+ * such as by a one byte edit, never hash the same. The tail is padded with
+ * zeros, which the length taken as seed tells apart.
+ */
+static uint64_t content_hash64(const char *str, const size_t len)
+{
+    uint64_t hash = len ^ 0xcbf29ce484222325ULL;
+
+    for (size_t i = 0; i < len; i += sizeof(uint64_t)) {
+        uint64_t v = 0;
+
+        memcpy(&v, str + i, len - i < sizeof(v) ? len - i : sizeof(v));
+        hash ^= v;
+        hash *= 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 29;
+    }
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    return hash ^ hash >> 32;
+}
+
 static int parse_file(char *restrict path, const mqd_t mq);
 
 static void out_of_memory(void)
@@ -304,8 +445,8 @@ static inline index_t *index_unpack_ptr(word_node_t *restrict node,
 }
 
 static inline void add_word(char *restrict str,
-                            word_node_t *restrict node,
-                            word_node_t *restrict node_heap,
+                            word_node_t *node,
+                            word_node_t *node_heap,
                             word_node_t **restrict node_heap_next,
                             const ssize_t heap_size)
 {
@@ -334,9 +475,9 @@ static inline void add_word(char *restrict str,
     }
 }
 
-static inline bool find_word(const char *restrict word,
-                             word_node_t *restrict node,
-                             word_node_t *restrict node_heap)
+static inline bool find_word_tree(const char *restrict word,
+                                  word_node_t *node,
+                                  word_node_t *node_heap)
 {
     for (;;) {
         if (UNLIKELY(!node))
@@ -354,6 +495,128 @@ static inline bool find_word(const char *restrict word,
     }
 }
 
+static inline bool find_word(const char *restrict word,
+                             const dict_t *restrict dict)
+{
+    const da_node_t *restrict nodes = dict->nodes;
+    uint32_t s = DA_ROOT;
+
+    for (;; word++) {
+        get_char_t ch = *word;
+        if (!ch)
+            return nodes[s].base & DA_EOW;
+        ch = map(ch);
+        if (UNLIKELY(ch == BAD_MAPPING))
+            return true;
+        uint32_t t = (nodes[s].base & ~DA_EOW) + ch;
+        if (t >= dict->size || nodes[t].check != s)
+            return false;
+        s = t;
+    }
+}
+
+/* Allocate tree of at most size nodes to add words to. Pages are only used
+ * once nodes are added, and go back to the system when it is freed.
+ */
+static word_node_t *node_heap_new(size_t size)
+{
+    word_node_t *heap = calloc(size, sizeof(word_node_t));
+    if (!heap)
+        out_of_memory();
+    return heap;
+}
+
+/* Make sure that nodes up to size are there, free ones zeroed */
+static void da_reserve(dict_t *d, bool **used, size_t size)
+{
+    if (size <= d->size)
+        return;
+
+    size_t n = d->size ? d->size : 1024;
+    while (n < size)
+        n *= 2;
+    d->nodes = realloc(d->nodes, n * sizeof(da_node_t));
+    *used = realloc(*used, n);
+    if (!d->nodes || !*used)
+        out_of_memory();
+    memset(d->nodes + d->size, 0, (n - d->size) * sizeof(da_node_t));
+    memset(*used + d->size, 0, n - d->size);
+    d->size = n;
+}
+
+/* Turn tree of n nodes into a double array, placing the children of each
+ * node first fit. Nodes of the tree are created after their parent, so they
+ * are visited in the order they are laid out, and every node has its slot by
+ * the time its children are placed.
+ */
+static void da_build(dict_t *d, word_node_t *heap, size_t n)
+{
+    uint32_t *slot = malloc(n * sizeof(uint32_t));
+    bool *used = NULL;
+    size_t next_check = DA_ROOT + 1;
+
+    if (!slot)
+        out_of_memory();
+    d->nodes = NULL;
+    d->size = 0;
+    da_reserve(d, &used, DA_ROOT + 1);
+    used[0] = used[DA_ROOT] = true;
+
+    slot[0] = DA_ROOT;
+    for (size_t j = 0; j < n; j++) {
+        const word_node_t *node = &heap[j];
+        uint32_t s = slot[j];
+        uint8_t child[MAX_WORD_NODES];
+        int n_child = 0;
+
+        for (int c = 0; c < MAX_WORD_NODES; c++) {
+            if (node->word_node_index[c].lo32)
+                child[n_child++] = c;
+        }
+        if (node->eow)
+            d->nodes[s].base |= DA_EOW;
+        if (!n_child)
+            continue;
+
+        /* Try every free slot for the first child, lowest first */
+        size_t base, pos, taken = 0;
+        for (pos = next_check;; pos++) {
+            da_reserve(d, &used, pos + MAX_WORD_NODES);
+            if (used[pos]) {
+                taken++;
+                continue;
+            }
+            if (pos < child[0])
+                continue;
+            base = pos - child[0];
+            int i = 1;
+            while (i < n_child && !used[base + child[i]])
+                i++;
+            if (i == n_child)
+                break;
+        }
+        /* Stop searching where few slots are left */
+        if (taken >= 0.95 * (pos - next_check + 1))
+            next_check = pos;
+
+        d->nodes[s].base |= base;
+        for (int i = 0; i < n_child; i++) {
+            uint32_t t = base + child[i];
+            used[t] = true;
+            d->nodes[t].check = s;
+            slot[node->word_node_index[child[i]].lo32] = t;
+        }
+        while (used[next_check])
+            next_check++;
+    }
+
+    /* Nothing can be found past the last node used */
+    while (d->size > DA_ROOT + 1 && !used[d->size - 1])
+        d->size--;
+    free(used);
+    free(slot);
+}
+
 static inline int read_dictionary(const char *dictfile)
 {
     struct stat buf;
@@ -387,7 +650,7 @@ static inline int read_dictionary(const char *dictfile)
         *bptr = '\0';
         ptr++;
         words++;
-        add_word(buffer, word_nodes, word_node_heap, &word_node_heap_next,
+        add_word(buffer, word_node_heap, word_node_heap, &word_node_heap_next,
                  WORD_NODES_HEAP_SIZE);
     }
     munmap((void *) dict, buf.st_size);
@@ -396,13 +659,100 @@ static inline int read_dictionary(const char *dictfile)
     return 0;
 }
 
-static inline void add_bad_spelling(const char *word, const size_t len)
+/* Record size and modification time of the word lists in h */
+static bool dict_sources(dict_header_t *h)
 {
-    if (find_word(word, printf_nodes, printf_node_heap))
-        return;
+    h->sources = ARRAY_SIZE(dictionary_paths);
+    for (size_t i = 0; i < ARRAY_SIZE(dictionary_paths); i++) {
+        struct stat buf;
+
+        if (stat(dictionary_paths[i], &buf) < 0)
+            return false;
+        h->source[i].size = buf.st_size;
+        h->source[i].mtime = buf.st_mtime;
+    }
+    return true;
+}
+
+/* Write the dictionary tree read from the word lists to path */
+static int write_dictionary(const char *path)
+{
+    dict_header_t h;
+    char tmp[PATH_MAX];
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DICT_MAGIC, sizeof(h.magic));
+    h.version = DICT_VERSION;
+    h.node_size = sizeof(da_node_t);
+    h.nodes = word_dict.size;
+    h.words = words;
+    h.dict_size = dict_size;
+    if (!dict_sources(&h))
+        return -1;
+
+    /* Concurrent runs see either the old file or the complete new one */
+    snprintf(tmp, sizeof(tmp), "%s.%i", path, getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp)
+        return -1;
+    bool ok =
+        fwrite(&h, sizeof(h), 1, fp) == 1 &&
+        fwrite(word_dict.nodes, sizeof(da_node_t), h.nodes, fp) == h.nodes;
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* Map precompiled dictionary read-only and look words up in it directly.
+ * Return -1 if it is missing, does not match this build, or is stale.
+ */
+static int map_dictionary(const char *path)
+{
+    struct stat buf;
+    dict_header_t h;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &buf) < 0 || (size_t) buf.st_size < sizeof(h)) {
+        close(fd);
+        return -1;
+    }
+
+    const dict_header_t *map =
+        mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    if (!dict_sources(&h) || memcmp(map->magic, DICT_MAGIC, 8) ||
+        map->version != DICT_VERSION ||
+        map->node_size != sizeof(da_node_t) || map->nodes <= DA_ROOT ||
+        (size_t) buf.st_size !=
+            sizeof(h) + (size_t) map->nodes * sizeof(da_node_t) ||
+        map->sources != h.sources ||
+        memcmp(map->source, h.source, sizeof(h.source))) {
+        munmap((void *) map, buf.st_size);
+        return -1;
+    }
+
+    /* Nodes are never written once built */
+    word_dict.nodes = (da_node_t *) (map + 1);
+    word_dict.size = map->nodes;
+    words = map->words;
+    dict_size = map->dict_size;
+    return 0;
+}
 
-    bad_spellings_total++;
-    hash_entry_t **head = &hash_bad_spellings[stress_hash_mulxror64(word, len)];
+static void count_bad_spelling(worker_t *restrict w,
+                               const char *word,
+                               const size_t len)
+{
+    w->bad_spellings_total++;
+    hash_entry_t **head =
+        &w->hash_bad_spellings[stress_hash_mulxror64(word, len)];
     hash_entry_t *he;
     for (he = *head; he; he = he->next) {
         if (!strcmp(he->token, word))
@@ -415,10 +765,233 @@ static inline void add_bad_spelling(const char *word, const size_t len)
     he->next = *head;
     *head = he;
     memcpy(he->token, word, len);
-    bad_spellings++;
+    w->bad_spellings++;
+}
+
+static inline void add_bad_spelling(worker_t *restrict w,
+                                    const char *word,
+                                    const size_t len)
+{
+    if (find_word(word, &printf_dict))
+        return;
+
+    if (cache_path) {
+        size_t need = w->file_words_len + len;
+        if (need > w->file_words_size) {
+            w->file_words_size = need > 2 * w->file_words_size
+                                     ? need
+                                     : 2 * w->file_words_size;
+            w->file_words = realloc(w->file_words, w->file_words_size);
+            if (UNLIKELY(!w->file_words))
+                out_of_memory();
+        }
+        memcpy(w->file_words + w->file_words_len, word, len);
+        w->file_words_len += len;
+        w->file_n_words++;
+    }
+    count_bad_spelling(w, word, len);
+}
+
+static cache_entry_t *cache_entry_new(const char *path,
+                                      size_t path_len,
+                                      const char *words,
+                                      size_t words_len)
+{
+    cache_entry_t *e = calloc(1, sizeof(*e) + path_len + 1 + words_len);
+    if (UNLIKELY(!e))
+        out_of_memory();
+    memcpy(e->data, path, path_len);
+    e->words = e->data + path_len + 1;
+    memcpy(e->words, words, words_len);
+    e->words_len = words_len;
+    return e;
+}
+
+static void cache_insert(cache_entry_t *e)
+{
+    cache_entry_t **head =
+        &cache_table[stress_hash_mulxror64(e->data, strlen(e->data))];
+
+    e->next = *head;
+    *head = e;
+}
+
+static cache_entry_t *cache_find(const char *path)
+{
+    cache_entry_t *e = cache_table[stress_hash_mulxror64(path, strlen(path))];
+
+    while (e && strcmp(e->data, path))
+        e = e->next;
+    return e;
+}
+
+/* Write entry back to the cache, once per run */
+static void cache_keep(worker_t *restrict w, cache_entry_t *e)
+{
+    if (__atomic_test_and_set(&e->kept, __ATOMIC_RELAXED))
+        return;
+    e->run_next = w->kept;
+    w->kept = e;
+}
+
+/* Read cache from path. It only applies to results of the same options and
+ * word lists, and is ignored otherwise.
+ */
+static void read_cache(const char *path)
+{
+    struct stat buf;
+    dict_header_t h;
+    char magic[8];
+    uint32_t version, flags;
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return;
+    if (fstat(fileno(fp), &buf) < 0 || fread(magic, 8, 1, fp) != 1 ||
+        memcmp(magic, CACHE_MAGIC, 8) || fread(&version, 4, 1, fp) != 1 ||
+        version != CACHE_VERSION || fread(&flags, 4, 1, fp) != 1 ||
+        flags != opt_flags || fread(&h.source, sizeof(h.source), 1, fp) != 1)
+        goto out;
+
+    dict_header_t now;
+    if (!dict_sources(&now) || memcmp(h.source, now.source, sizeof(h.source)))
+        goto out;
+
+    char *data = NULL;
+    cache_record_t r;
+    while (fread(&r, sizeof(r), 1, fp) == 1) {
+        size_t len = (size_t) r.path_len + r.words_len;
+        if (!r.path_len || len > (size_t) buf.st_size)
+            break;
+        char *p = realloc(data, len);
+        if (!p)
+            out_of_memory();
+        data = p;
+        if (fread(data, 1, len, fp) != len)
+            break;
+
+        cache_entry_t *e =
+            cache_entry_new(data, r.path_len, data + r.path_len, r.words_len);
+        e->size = r.size;
+        e->mtime = r.mtime;
+        e->hash = r.hash;
+        e->lines = r.lines;
+        e->n_words = r.n_words;
+        cache_insert(e);
+    }
+    free(data);
+out:
+    fclose(fp);
+}
+
+/* Write entries of every file seen in this run, so that files removed since
+ * the last run drop out
+ */
+static int write_cache(const char *path)
+{
+    dict_header_t h;
+    char tmp[PATH_MAX];
+    uint32_t version = CACHE_VERSION, flags = opt_flags;
+
+    if (!dict_sources(&h))
+        return -1;
+
+    snprintf(tmp, sizeof(tmp), "%s.%i", path, getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp)
+        return -1;
+    fwrite(CACHE_MAGIC, 8, 1, fp);
+    fwrite(&version, 4, 1, fp);
+    fwrite(&flags, 4, 1, fp);
+    fwrite(&h.source, sizeof(h.source), 1, fp);
+    for (int i = 0; i < n_workers; i++) {
+        for (cache_entry_t *e = workers[i].kept; e; e = e->run_next) {
+            cache_record_t r = {
+                .size = e->size,
+                .mtime = e->mtime,
+                .hash = e->hash,
+                .lines = e->lines,
+                .n_words = e->n_words,
+                .path_len = strlen(e->data),
+                .words_len = e->words_len,
+            };
+            fwrite(&r, sizeof(r), 1, fp);
+            fwrite(e->data, 1, r.path_len, fp);
+            fwrite(e->words, 1, r.words_len, fp);
+        }
+    }
+    bool ok = !ferror(fp);
+    if (fclose(fp) != 0 || !ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void bench_add(const char *word, size_t len)
+{
+    if (bench_words_len + len > bench_words_size) {
+        bench_words_size = 2 * (bench_words_len + len);
+        bench_words = realloc(bench_words, bench_words_size);
+        if (!bench_words)
+            out_of_memory();
+    }
+    memcpy(bench_words + bench_words_len, word, len);
+    bench_words_len += len;
+}
+
+static double now_sec(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Time lookups of the words collected from the scan in the tree the
+ * dictionary is built from and in the double array made from it
+ */
+static void bench_find_word(void)
+{
+    size_t n = 0, found[2] = {0, 0};
+    double rate[2];
+
+    for (size_t i = 0; i < bench_words_len; i += strlen(bench_words + i) + 1)
+        n++;
+    if (!n)
+        return;
+    for (int impl = 0; impl < 2; impl++) {
+        size_t lookups = 0;
+        double start = now_sec(), elapsed;
+
+        do {
+            const char *p = bench_words, *end = bench_words + bench_words_len;
+            size_t hits = 0;
+            for (; p < end; p += strlen(p) + 1) {
+                hits += impl ? find_word(p, &word_dict)
+                             : find_word_tree(p, word_node_heap,
+                                              word_node_heap);
+            }
+            found[impl] = hits;
+            lookups += n;
+            elapsed = now_sec() - start;
+        } while (elapsed < 0.5);
+        rate[impl] = lookups / elapsed / 1e6;
+    }
+
+    size_t tree_size = (word_node_heap_next - word_node_heap) *
+                       sizeof(word_node_t);
+    printf("find_word benchmark, %zu words:\n", n);
+    printf("  tree          %8.2f M words/s %10zu bytes\n", rate[0],
+           tree_size);
+    printf("  double array  %8.2f M words/s %10zu bytes\n", rate[1],
+           word_dict.size * sizeof(da_node_t));
+    if (found[0] != found[1])
+        printf("  results differ: %zu and %zu words found\n", found[0],
+               found[1]);
 }
 
-static void check_words(token_t *token)
+static void check_words(worker_t *restrict w, token_t *token)
 {
     char *p1 = token->token;
     const char *p3 = p1 + token_len(token);
@@ -435,8 +1008,10 @@ static void check_words(token_t *token)
         *p2 = '\0';
 
         if (LIKELY(p2 - p1 > 1)) {
-            if (!find_word(p1, word_nodes, word_node_heap))
-                add_bad_spelling(p1, 1 + p2 - p1);
+            if (UNLIKELY(bench))
+                bench_add(p1, 1 + p2 - p1);
+            if (!find_word(p1, &word_dict))
+                add_bad_spelling(w, p1, 1 + p2 - p1);
         }
         p1 = p2 + 1;
     }
@@ -453,6 +1028,7 @@ static inline void parser_new(parser_t *restrict p,
     p->data_end = data_end;
     p->ptr = data;
     p->skip_white_space = skip_white_space;
+    p->lines = 0;
 }
 
 /* Fetch the next character from the input. */
@@ -469,6 +1045,101 @@ static inline void unget_char(parser_t *p)
     p->ptr--;
 }
 
+/* Classes of bytes the lexer skips in bulk rather than one get_char() at a
+ * time.
+ */
+typedef enum {
+    RUN_WHITESPACE,  /* Spaces and tabs */
+    RUN_IDENTIFIER,  /* Letters, digits and underscores */
+    RUN_NOT_STAR,    /* Block comment body, up to the next '*' */
+    RUN_NOT_NEWLINE, /* Line comment body, up to the '\n' */
+} run_t;
+
+static inline bool run_byte(const run_t run, const uint8_t ch)
+{
+    switch (run) {
+    case RUN_WHITESPACE:
+        return !is_not_whitespace[ch];
+    case RUN_IDENTIFIER:
+        return !is_not_identifier[ch];
+    case RUN_NOT_STAR:
+        return ch != '*';
+    default:
+        return ch != '\n';
+    }
+}
+
+#if defined(__AVX2__)
+typedef __m256i vec_t;
+#define VEC_LEN 32
+#define VEC_ALL 0xffffffffU
+#define vec_load(p) _mm256_loadu_si256((const __m256i *) (p))
+#define vec_set1(c) _mm256_set1_epi8(c)
+#define vec_eq(a, b) _mm256_cmpeq_epi8(a, b)
+#define vec_gt(a, b) _mm256_cmpgt_epi8(a, b)
+#define vec_and(a, b) _mm256_and_si256(a, b)
+#define vec_or(a, b) _mm256_or_si256(a, b)
+#define vec_mask(v) ((uint32_t) _mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+typedef __m128i vec_t;
+#define VEC_LEN 16
+#define VEC_ALL 0xffffU
+#define vec_load(p) _mm_loadu_si128((const __m128i *) (p))
+#define vec_set1(c) _mm_set1_epi8(c)
+#define vec_eq(a, b) _mm_cmpeq_epi8(a, b)
+#define vec_gt(a, b) _mm_cmpgt_epi8(a, b)
+#define vec_and(a, b) _mm_and_si128(a, b)
+#define vec_or(a, b) _mm_or_si128(a, b)
+#define vec_mask(v) ((uint32_t) _mm_movemask_epi8(v))
+#endif
+
+#ifdef VEC_LEN
+/* Bit i is set when byte i of v belongs to the run. The comparisons are
+ * signed, so bytes above 0x7f fall outside every range, as in the tables.
+ */
+static inline uint32_t run_vec(const run_t run, const vec_t v)
+{
+    switch (run) {
+    case RUN_WHITESPACE:
+        return vec_mask(
+            vec_or(vec_eq(v, vec_set1(' ')), vec_eq(v, vec_set1('\t'))));
+    case RUN_IDENTIFIER: {
+        /* Setting bit 5 folds upper case onto lower case */
+        const vec_t lower = vec_or(v, vec_set1(0x20));
+        const vec_t alpha = vec_and(vec_gt(lower, vec_set1('a' - 1)),
+                                    vec_gt(vec_set1('z' + 1), lower));
+        const vec_t digit = vec_and(vec_gt(v, vec_set1('0' - 1)),
+                                    vec_gt(vec_set1('9' + 1), v));
+        return vec_mask(vec_or(vec_or(alpha, digit), vec_eq(v, vec_set1('_'))));
+    }
+    case RUN_NOT_STAR:
+        return vec_mask(vec_eq(v, vec_set1('*'))) ^ VEC_ALL;
+    default:
+        return vec_mask(vec_eq(v, vec_set1('\n'))) ^ VEC_ALL;
+    }
+}
+#endif
+
+/* Return the end of the run of bytes starting at ptr. Whole vectors are
+ * classified at once while they fit before end, the tail byte by byte.
+ */
+static inline unsigned char *scan_run(unsigned char *ptr,
+                                      const unsigned char *end,
+                                      const run_t run)
+{
+#ifdef VEC_LEN
+    while (end - ptr >= VEC_LEN) {
+        uint32_t stop = run_vec(run, vec_load(ptr)) ^ VEC_ALL;
+        if (stop)
+            return ptr + __builtin_ctz(stop);
+        ptr += VEC_LEN;
+    }
+#endif
+    while (ptr < end && run_byte(run, *ptr))
+        ptr++;
+    return ptr;
+}
+
 static int cmp_format(const void *restrict p1, const void *restrict p2)
 {
     const format_t *restrict f1 = (const format_t *restrict) p1;
@@ -549,6 +1220,17 @@ static inline void token_eos(token_t *t)
     *(t->ptr) = '\0';
 }
 
+/* Append len bytes at once, keeping room for the terminating NUL. */
+static inline void token_append_run(token_t *restrict t,
+                                    const unsigned char *restrict str,
+                                    size_t len)
+{
+    while (UNLIKELY((size_t) (t->token_end - t->ptr) <= len))
+        token_expand(t);
+    memcpy(t->ptr, str, len);
+    t->ptr += len;
+}
+
 static inline void token_cat_str(token_t *restrict t, const char *restrict str)
 {
     while (*str) {
@@ -561,34 +1243,27 @@ static inline void token_cat_str(token_t *restrict t, const char *restrict str)
 /* Skip over C-style comments, discarding their contents. */
 static get_char_t skip_comments(parser_t *p)
 {
-    get_char_t ch;
     get_char_t nextch = get_char(p);
 
     if (nextch == '/') {
-        do {
-            ch = get_char(p);
-            if (UNLIKELY(ch == PARSER_EOF))
-                return ch;
-        } while (ch != '\n');
-
+        p->ptr = scan_run(p->ptr, p->data_end, RUN_NOT_NEWLINE);
+        if (UNLIKELY(p->ptr == p->data_end))
+            return PARSER_EOF;
+        p->ptr++;
         return PARSER_COMMENT_FOUND;
     }
     if (LIKELY(nextch == '*')) {
         for (;;) {
-            ch = get_char(p);
-
-            if (UNLIKELY(ch == '*')) {
-                ch = get_char(p);
-
-                if (LIKELY(ch == '/'))
-                    return PARSER_COMMENT_FOUND;
-                if (UNLIKELY(ch == PARSER_EOF))
-                    return ch;
-
-                unget_char(p);
+            p->ptr = scan_run(p->ptr, p->data_end, RUN_NOT_STAR);
+            if (UNLIKELY(p->ptr == p->data_end))
+                return PARSER_EOF;
+            /* Past the '*', which may be the first of several */
+            if (UNLIKELY(++p->ptr == p->data_end))
+                return PARSER_EOF;
+            if (*p->ptr == '/') {
+                p->ptr++;
+                return PARSER_COMMENT_FOUND;
             }
-            if (UNLIKELY(ch == PARSER_EOF))
-                return ch;
         }
     }
     if (UNLIKELY(nextch == PARSER_EOF))
@@ -609,8 +1284,7 @@ static get_char_t skip_macros(parser_t *p)
 
         ch = get_char(p);
         if (ch == '\n') {
-            lines++;
-            lineno++;
+            p->lines++;
             if (!continuation)
                 return ch;
             continuation = false;
@@ -727,20 +1401,14 @@ static get_char_t parse_identifier(parser_t *restrict p,
                                    token_t *restrict t,
                                    get_char_t ch)
 {
+    unsigned char *end = scan_run(p->ptr, p->data_end, RUN_IDENTIFIER);
+
     t->type = TOKEN_IDENTIFIER;
     token_append(t, ch);
-
-    for (;;) {
-        ch = get_char(p);
-        uint8_t ch8 = (uint8_t) ch;
-
-        if (UNLIKELY(is_not_identifier[ch8])) {
-            unget_char(p);
-            token_eos(t);
-            return PARSER_OK;
-        }
-        token_append(t, ch);
-    }
+    token_append_run(t, p->ptr, end - p->ptr);
+    token_eos(t);
+    p->ptr = end;
+    return PARSER_OK;
 }
 
 /* Process escape sequences at the end of a string literal.
@@ -1047,8 +1715,7 @@ static inline get_char_t parse_newline(parser_t *restrict p,
                                        token_t *restrict t,
                                        get_char_t ch)
 {
-    lines++;
-    lineno++;
+    p->lines++;
     return parse_backslash(p, t, ch);
 }
 
@@ -1065,13 +1732,7 @@ static inline get_char_t parse_whitespace(parser_t *restrict p UNUSED,
 {
     t->type = TOKEN_IDENTIFIER;
     token_append(t, ch);
-
-    for (;;) {
-        uint8_t ch8 = (uint8_t) get_char(p);
-        if (is_not_whitespace[ch8])
-            break;
-    }
-    unget_char(p);
+    p->ptr = scan_run(p->ptr, p->data_end, RUN_WHITESPACE);
     token_eos(t);
 
     return parse_simple(t, ' ', TOKEN_WHITE_SPACE);
@@ -1300,11 +1961,10 @@ static get_char_t parse_message(const char *restrict path UNUSED,
 static void parse_messages(const char *restrict path,
                            unsigned char *restrict data,
                            unsigned char *restrict data_end,
-                           token_t *restrict t,
-                           token_t *restrict line,
-                           token_t *restrict str)
+                           worker_t *restrict w)
 {
     parser_t p;
+    token_t *t = &w->t;
 
     parser_new(&p, data, data_end, true);
     bool source_emit = false;
@@ -1313,11 +1973,12 @@ static void parse_messages(const char *restrict path,
 
     while ((get_token(&p, t)) != PARSER_EOF) {
         if ((t->type == TOKEN_IDENTIFIER) &&
-            (find_word(t->token, printf_nodes, printf_node_heap))) {
-            parse_message(path, &source_emit, &p, t, line, str);
+            (find_word(t->token, &printf_dict))) {
+            parse_message(path, &source_emit, &p, t, &w->line, &w->str);
         }
         token_clear(t);
     }
+    w->lines += p.lines;
 
     if (opt_flags & OPT_CHECK_WORDS)
         return;
@@ -1329,20 +1990,20 @@ static void parse_messages(const char *restrict path,
 static void parse_literal_strings(const char *restrict path UNUSED,
                                   unsigned char *restrict data,
                                   unsigned char *restrict data_end,
-                                  token_t *restrict t,
-                                  token_t *restrict line UNUSED,
-                                  token_t *restrict str UNUSED)
+                                  worker_t *restrict w)
 {
     parser_t p;
+    token_t *t = &w->t;
     parser_new(&p, data, data_end, true);
 
     token_clear(t);
 
     while ((get_token(&p, t)) != PARSER_EOF) {
         if (t->type == TOKEN_LITERAL_STRING)
-            check_words(t);
+            check_words(w, t);
         token_clear(t);
     }
+    w->lines += p.lines;
 }
 
 static int parse_dir(char *restrict path, const mqd_t mq)
@@ -1409,8 +2070,6 @@ static int parse_file(char *restrict path, const mqd_t mq)
         close(fd);
         return -1;
     }
-    lineno = 0;
-
     if (LIKELY(S_ISREG(buf.st_mode))) {
         size_t len = strlen(path);
 
@@ -1418,10 +2077,14 @@ static int parse_file(char *restrict path, const mqd_t mq)
                    ((len >= 2) && !strcmp(path + len - 2, ".h")) ||
                    ((len >= 4) && !strcmp(path + len - 4, ".cpp")))) {
             if (LIKELY(buf.st_size > 0)) {
-                msg_t msg;
-
-                msg.data = mmap(NULL, (size_t) buf.st_size, PROT_READ,
-                                MAP_PRIVATE | MAP_POPULATE, fd, 0);
+                msg_t msg = {.data = NULL, .cached = NULL};
+                cache_entry_t *e = cache_path ? cache_find(path) : NULL;
+
+                if (e && e->size == buf.st_size && e->mtime == buf.st_mtime)
+                    msg.cached = e;
+                else /* Pages are faulted in by the parser threads */
+                    msg.data = mmap(NULL, (size_t) buf.st_size, PROT_READ,
+                                    MAP_PRIVATE, fd, 0);
                 if (UNLIKELY(msg.data == MAP_FAILED)) {
                     close(fd);
                     fprintf(stderr, "Cannot mmap %s, errno=%d (%s)\n", path,
@@ -1432,6 +2095,7 @@ static int parse_file(char *restrict path, const mqd_t mq)
 
                 msg.parse_func = parse_func;
                 msg.size = buf.st_size;
+                msg.mtime = buf.st_mtime;
                 strncpy(msg.filename, path, sizeof(msg.filename) - 1);
                 mq_send(mq, (char *) &msg, sizeof(msg), 1);
             }
@@ -1451,23 +2115,95 @@ static void *reader(void *arg)
 {
     static void *nowt = NULL;
     const context_t *ctxt = arg;
-    msg_t msg = {NULL, 0, NULL, ""};
+    msg_t msg = {.data = NULL, .cached = NULL};
 
     parse_file(ctxt->path, ctxt->mq);
-    mq_send(ctxt->mq, (char *) &msg, sizeof(msg), 1);
+    /* Tell every parser thread that there are no more files */
+    for (int i = 0; i < ctxt->workers; i++)
+        mq_send(ctxt->mq, (char *) &msg, sizeof(msg), 1);
 
     return &nowt;
 }
 
-static int parse_path(char *path,
-                      token_t *restrict t,
-                      token_t *restrict line,
-                      token_t *restrict str)
+/* Count findings of file as if it was parsed again */
+static void cache_replay(worker_t *w, cache_entry_t *e)
+{
+    w->lines += e->lines;
+    for (const char *p = e->words; p < e->words + e->words_len;) {
+        size_t len = strlen(p) + 1;
+        count_bad_spelling(w, p, len);
+        p += len;
+    }
+    cache_keep(w, e);
+}
+
+/* Parse file missed by the cache and cache its findings. A file whose time
+ * stamp changed still counts as unchanged if its contents hash the same, as
+ * after a checkout.
+ */
+static void parse_cached(const msg_t *msg, worker_t *w)
+{
+    cache_entry_t *e = cache_find(msg->filename);
+
+    if (e && e->size == (int64_t) msg->size &&
+        e->hash == content_hash64(msg->data, msg->size)) {
+        e->mtime = msg->mtime;
+        cache_replay(w, e);
+        return;
+    }
+
+    uint32_t lines = w->lines;
+    w->file_words_len = 0;
+    w->file_n_words = 0;
+    msg->parse_func(msg->filename, msg->data,
+                    (uint8_t *) msg->data + msg->size, w);
+
+    e = cache_entry_new(msg->filename, strlen(msg->filename), w->file_words,
+                        w->file_words_len);
+    e->size = msg->size;
+    e->mtime = msg->mtime;
+    e->hash = content_hash64(msg->data, msg->size);
+    e->lines = w->lines - lines;
+    e->n_words = w->file_n_words;
+    cache_keep(w, e);
+}
+
+static void *parser(void *arg)
+{
+    static void *nowt = NULL;
+    worker_t *w = arg;
+
+    for (;;) {
+        msg_t msg;
+
+        ssize_t rc = mq_receive(w->mq, (char *) &msg, sizeof(msg), NULL);
+        if (UNLIKELY(rc < 0))
+            break;
+        if (msg.cached) {
+            cache_replay(w, msg.cached);
+            continue;
+        }
+        if (UNLIKELY(msg.data == 0))
+            break;
+
+        madvise(msg.data, msg.size, MADV_WILLNEED);
+        if (cache_path)
+            parse_cached(&msg, w);
+        else
+            msg.parse_func(msg.filename, msg.data,
+                           (uint8_t *) msg.data + msg.size, w);
+        munmap(msg.data, msg.size);
+    }
+
+    return &nowt;
+}
+
+static int parse_path(char *path)
 {
     mqd_t mq = -1;
     struct mq_attr attr;
     char mq_name[64];
-    int rc;
+    int rc, started;
     context_t ctxt;
     pthread_t pthread;
 
@@ -1482,38 +2218,72 @@ static int parse_path(char *path,
     if (mq < 0)
         return -1;
 
+    for (started = 0; started < n_workers; started++) {
+        workers[started].mq = mq;
+        if (pthread_create(&workers[started].pthread, NULL, parser,
+                           &workers[started]))
+            break;
+    }
+    if (!started) {
+        rc = -1;
+        goto err;
+    }
+
     ctxt.path = path;
     ctxt.mq = mq;
+    ctxt.workers = started;
 
     rc = pthread_create(&pthread, NULL, reader, &ctxt);
     if (rc) {
+        /* Let the parser threads finish */
+        msg_t msg = {.data = NULL, .cached = NULL};
+        for (int i = 0; i < started; i++)
+            mq_send(mq, (char *) &msg, sizeof(msg), 1);
         rc = -1;
-        goto err;
-    }
-
-    for (;;) {
-        msg_t msg;
-
-        rc = mq_receive(mq, (char *) &msg, sizeof(msg), NULL);
-        if (UNLIKELY(rc < 0))
-            break;
-        if (UNLIKELY(msg.data == 0))
-            break;
-
-        msg.parse_func(msg.filename, msg.data, (uint8_t *) msg.data + msg.size,
-                       t, line, str);
-        munmap(msg.data, msg.size);
+    } else {
+        pthread_join(pthread, NULL);
     }
 
-    rc = 0;
+    for (int i = 0; i < started; i++)
+        pthread_join(workers[i].pthread, NULL);
 err:
-    pthread_join(pthread, NULL);
     mq_close(mq);
     mq_unlink(mq_name);
 
     return rc;
 }
 
+/* Fold findings of the parser threads into the global ones */
+static void merge_workers(void)
+{
+    for (int i = 0; i < n_workers; i++) {
+        worker_t *w = &workers[i];
+
+        lines += w->lines;
+        bad_spellings_total += w->bad_spellings_total;
+        for (size_t j = 0; j < SIZEOF_ARRAY(w->hash_bad_spellings); j++) {
+            hash_entry_t *he = w->hash_bad_spellings[j], *next;
+
+            for (; he; he = next) {
+                next = he->next;
+                /* Buckets match, as the hash does not depend on the table */
+                hash_entry_t **head = &hash_bad_spellings[j], *e;
+                for (e = *head; e; e = e->next) {
+                    if (!strcmp(e->token, he->token))
+                        break;
+                }
+                if (e) {
+                    free(he);
+                    continue;
+                }
+                he->next = *head;
+                *head = he;
+                bad_spellings++;
+            }
+        }
+    }
+}
+
 static int cmpstr(const void *p1, const void *p2)
 {
     return strcmp(*(char *const *) p1, *(char *const *) p2);
@@ -1558,10 +2328,15 @@ static void dump_bad_spellings(void)
 
 static inline void load_printfs(void)
 {
+    printf_node_heap = node_heap_new(PRINTK_NODES_HEAP_SIZE);
+    printf_node_heap_next = &printf_node_heap[1];
     for (size_t i = 0; i < SIZEOF_ARRAY(printfs); i++) {
-        add_word(printfs[i], printf_nodes, printf_node_heap,
+        add_word(printfs[i], printf_node_heap, printf_node_heap,
                  &printf_node_heap_next, PRINTK_NODES_HEAP_SIZE);
     }
+    da_build(&printf_dict, printf_node_heap,
+             printf_node_heap_next - printf_node_heap);
+    free(printf_node_heap);
 }
 
 static void set_is_not_whitespace(void)
@@ -1588,8 +2363,54 @@ static void set_is_not_identifier(void)
 /* TODO: exclude strings in 'getopt' */
 int main(int argc, char **argv)
 {
-    token_t t, line, str;
     static char buffer[65536];
+    static const struct option long_options[] = {
+        {"bench", no_argument, NULL, 'B'},
+        {"build-dict", required_argument, NULL, 'b'},
+        {"cache", required_argument, NULL, 'c'},
+        {"dict", required_argument, NULL, 'd'},
+        {NULL, 0, NULL, 0},
+    };
+    const char *build_dict = NULL, *dict = NULL;
+    int opt;
+
+    n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt_long(argc, argv, "j:", long_options, NULL)) != -1) {
+        switch (opt) {
+        case 'B':
+            bench = true;
+            break;
+        case 'b':
+            build_dict = optarg;
+            break;
+        case 'c':
+            cache_path = optarg;
+            break;
+        case 'd':
+            dict = optarg;
+            break;
+        case 'j':
+            n_workers = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr,
+                    "Usage: %s [-j threads] [--dict file] [--cache file] "
+                    "[path...]\n"
+                    "       %s --build-dict file\n"
+                    "       %s --bench [path...]\n",
+                    argv[0], argv[0], argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (n_workers < 1)
+        n_workers = 1;
+    /* Words are collected from a single thread, and the tree is kept */
+    if (bench) {
+        n_workers = 1;
+        cache_path = NULL;
+        dict = NULL;
+        build_dict = NULL;
+    }
 
     token_cat = token_cat_normal;
 
@@ -1603,9 +2424,19 @@ int main(int argc, char **argv)
     set_mapping();
     load_printfs();
     qsort(formats, SIZEOF_ARRAY(formats), sizeof(format_t), cmp_format);
-    if (opt_flags & OPT_CHECK_WORDS) {
+    if (dict && !build_dict && map_dictionary(dict) < 0) {
+        fprintf(stderr, "Cannot use dictionary %s, it is invalid or stale\n",
+                dict);
+        exit(EXIT_FAILURE);
+    }
+    if (!dict && !build_dict && !bench &&
+        map_dictionary(DICT_DEFAULT_PATH) == 0)
+        dict = DICT_DEFAULT_PATH;
+    if (((opt_flags & OPT_CHECK_WORDS) && !dict) || build_dict) {
         int ret = 0;
 
+        word_node_heap = node_heap_new(WORD_NODES_HEAP_SIZE);
+        word_node_heap_next = &word_node_heap[1];
         for (size_t i = 0; i < ARRAY_SIZE(dictionary_paths); i++) {
             if (read_dictionary(dictionary_paths[i]) < 0) {
                 ret = -1;
@@ -1617,28 +2448,55 @@ int main(int argc, char **argv)
             fprintf(stderr, "No dictionary found.\n");
             exit(EXIT_FAILURE);
         }
+        da_build(&word_dict, word_node_heap,
+                 word_node_heap_next - word_node_heap);
+        if (!bench)
+            free(word_node_heap);
+    }
+    if (build_dict) {
+        if (write_dictionary(build_dict) < 0) {
+            fprintf(stderr, "Cannot write dictionary %s, errno=%d (%s)\n",
+                    build_dict, errno, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        exit(EXIT_SUCCESS);
     }
 
-    token_new(&t);
-    token_new(&line);
-    token_new(&str);
+    workers = calloc(n_workers, sizeof(worker_t));
+    if (!workers)
+        out_of_memory();
+    for (int i = 0; i < n_workers; i++) {
+        token_new(&workers[i].t);
+        token_new(&workers[i].line);
+        token_new(&workers[i].str);
+    }
 
     fflush(stdout);
     setvbuf(stdout, buffer, _IOFBF, sizeof(buffer));
 
+    if (cache_path)
+        read_cache(cache_path);
+
     if (argc == optind) {
-        parse_path(".", &t, &line, &str);
+        parse_path(".");
         optind++;
     } else {
         while (argc > optind) {
-            parse_path(argv[optind], &t, &line, &str);
+            parse_path(argv[optind]);
             optind++;
         }
     }
 
-    token_free(&str);
-    token_free(&line);
-    token_free(&t);
+    for (int i = 0; i < n_workers; i++) {
+        token_free(&workers[i].str);
+        token_free(&workers[i].line);
+        token_free(&workers[i].t);
+    }
+    merge_workers();
+    if (cache_path && write_cache(cache_path) < 0)
+        fprintf(stderr, "Cannot write cache %s, errno=%d (%s)\n", cache_path,
+                errno, strerror(errno));
+    free(workers);
 
     dump_bad_spellings();
 
@@ -1652,6 +2510,8 @@ int main(int argc, char **argv)
         printf("%" PRIu32 " unique bad spellings found (%" PRIu32
                " non-unique)\n",
                bad_spellings, bad_spellings_total);
+    if (bench)
+        bench_find_word();
 
     fflush(stdout);
 
@@ -0,0 +1,26 @@
+# Test of 'q_shuffle' on empty, single element and longer queues, exchanging values and relinking nodes
+option fail 0
+option malloc 0
+new
+shuffle
+ih dolphin
+shuffle 3
+it bear
+it gerbil 5
+shuffle 10
+size
+option relink 1
+free
+new
+shuffle
+ih dolphin
+shuffle
+it bear
+it gerbil 5
+shuffle 10 each
+size
+rh
+rh
+size
+free
+quit
@@ -0,0 +1,19 @@
+# Test of command and option lookup: 'help', 'option', and names shared or prefixed by others
+option fail 0
+option malloc 0
+help
+option
+option time 2000000
+new
+ih dolphin
+ih bear
+it gerbil
+reverse
+reverseK 2
+time reverse
+option time 1000000
+show
+rh bear
+rt dolphin
+rh gerbil
+free
@@ -0,0 +1,24 @@
+# Test of recording and replaying arguments that are integers or only look like ones
+option fail 0
+option malloc 0
+new
+ih 0
+ih -1 2
+it 2147483647
+it -2147483648
+it 007
+it +5
+it 1e3
+it 99999999999
+size 3
+reverse
+rh 99999999999
+rh 1e3
+rh +5
+rh 007
+rh -2147483648
+rh 2147483647
+rh 0
+rh -1
+rt -1
+free
@@ -0,0 +1,16 @@
+# Test of replaying 'trace-21-replay.bin', recorded from the commands of this file
+option fail 0
+option malloc 0
+new
+ih dolphin
+ih bear 2
+it gerbil 3
+reverse
+size 2
+rh gerbil
+rh gerbil
+rh gerbil
+rt bear
+rt bear
+rh dolphin
+free
@@ -0,0 +1,19 @@
+# Test of 'repeat' and 'loop' blocks, including nested ones
+option fail 0
+option malloc 0
+new
+repeat 3 ih dolphin
+loop 2
+it bear
+loop 2
+it gerbil
+end
+end
+size
+repeat 3 rh dolphin
+loop 2
+rh bear
+repeat 2 rh gerbil
+end
+size
+free
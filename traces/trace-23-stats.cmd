@@ -0,0 +1,13 @@
+# Test of 'stats', 'stats reset', and latencies shown on quit with the 'profile' option
+option fail 0
+option malloc 0
+new
+it RAND 100
+sort
+stats
+stats reset
+repeat 10 size
+time reverse
+stats
+option profile 1
+free
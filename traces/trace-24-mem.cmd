@@ -0,0 +1,11 @@
+# Test of 'mem' reporting allocations before, during, and after queue operations
+option fail 0
+option malloc 0
+mem
+new
+it RAND 1000
+mem
+sort
+mem
+free
+mem
@@ -0,0 +1,11 @@
+# Test of the 'alloc_profile' option, turned on after the first allocations
+option fail 0
+option malloc 0
+new
+it dolphin 10
+option alloc_profile 5
+it bear 10
+ih RAND 20
+rh
+rt bear
+free
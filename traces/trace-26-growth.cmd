@@ -0,0 +1,5 @@
+# Test of the growth of 'q_sort' and 'q_size' estimated by 'complexity', failing on a faster growing class
+option fail 0
+option malloc 0
+complexity sort nlogn
+complexity size n
@@ -3,17 +3,35 @@
  */
 
 #include <arpa/inet.h> /* inet_ntoa */
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#endif
+
+#include "web.h"
 
 #define LISTENQ 1024 /* second argument to listen() */
 #define MAXLINE 1024 /* max length of a line */
-#define BUFSIZE 1024
+#define BUFSIZE 4096 /* bytes read from a client at once */
+
+/* Longest command handed to the console, which is the size of the linenoise
+ * buffer
+ */
+#define MAXCMD 4096
+
+/* How long to wait for a client that does not take its response */
+#define SEND_TIMEOUT_MS 5000
 
 #ifndef DEFAULT_PORT
 #define DEFAULT_PORT 9999 /* use this port if none given as arg to main() */
@@ -23,104 +41,586 @@
 #define TCP_CORK TCP_NOPUSH
 #endif
 
-static int server_fd;
-
+/* Every client connection stays open across requests (HTTP/1.1 keep-alive),
+ * and any number of requests may arrive before the first is answered
+ * (pipelining). Complete requests are queued in arrival order, whichever
+ * connection they come from, and their commands handed to the console one at
+ * a time, so the responses on each connection come back in order.
+ *
+ * A GET request carries a single command in its path, where '/' separates
+ * the words. A POST request carries a batch of commands in its body, one per
+ * line, and is answered with one record per command:
+ *
+ *   <ok|error> <length of output> <command>\n<output>
+ */
 typedef struct {
-    int fd;            /* descriptor for this buf */
-    int count;         /* unread byte in this buf */
-    char *bufptr;      /* next unread byte in this buf */
-    char buf[BUFSIZE]; /* internal buffer */
-} rio_t;
+    char *data;
+    size_t len, size;
+} web_buf_t;
+
+struct __web_req;
+
+typedef struct __web_conn {
+    int fd;
+    web_buf_t in;    /* Bytes received but not parsed yet */
+    int pending;     /* Requests queued or running */
+    bool closed;     /* Peer went away, or no more requests are wanted */
+    bool eof;        /* Peer sent all it will, but may wait for answers */
+    bool last;       /* Request after which the connection closes came */
+    struct __web_req *body_req; /* Request whose body is being received */
+    size_t body_left;           /* Bytes of that body still to come */
+    struct __web_conn *next;
+} web_conn_t;
+
+typedef struct __web_req {
+    web_conn_t *conn;
+    web_buf_t cmds;  /* Command lines, each terminated by '\0' */
+    size_t pos;      /* Offset of the next command to run */
+    size_t line;     /* Length of command line being received */
+    bool batch;      /* Whether commands came in the body of a POST */
+    bool keep_alive; /* Whether connection stays open after response */
+    bool http10;     /* Whether client speaks HTTP/1.0 */
+    bool failed;     /* Whether running command reported an error */
+    struct __web_req *next;
+} web_req_t;
+
+int web_connfd = 0;
+
+static int server_fd = -1;
+static web_conn_t *conns = NULL;
+static web_req_t *queue_head = NULL, *queue_tail = NULL;
+static web_req_t *active = NULL; /* Request whose commands run */
+static const char *running = NULL; /* Command of it handed to the console */
+
+/* Output of the running command, and records of the batch run so far */
+static web_buf_t out, batch_out;
+
+#if defined(__linux__)
+static int epoll_fd = -1;
+/* Tags told apart from connections in epoll events */
+static char stdin_tag, server_tag;
+#endif
 
-typedef struct {
-    char filename[512];
-    off_t offset; /* for support Range */
-    size_t end;
-} http_request_t;
+static bool buf_reserve(web_buf_t *b, size_t len)
+{
+    if (b->len + len <= b->size)
+        return true;
+    size_t size = b->size ? 2 * b->size : BUFSIZE;
+    while (size < b->len + len)
+        size *= 2;
+    char *data = realloc(b->data, size);
+    if (!data)
+        return false;
+    b->data = data;
+    b->size = size;
+    return true;
+}
 
-static void rio_readinitb(rio_t *rp, int fd)
+static bool buf_append(web_buf_t *b, const char *s, size_t len)
 {
-    rp->fd = fd;
-    rp->count = 0;
-    rp->bufptr = rp->buf;
+    if (!buf_reserve(b, len))
+        return false;
+    memcpy(b->data + b->len, s, len);
+    b->len += len;
+    return true;
 }
 
-/* This is a wrapper for the Unix read() function that transfers min(n, count)
- * bytes from an internal buffer to a user buffer, where n is the number of
- * bytes requested by the user and count is the number of unread bytes in the
- * internal buffer. On entry, rio_read() refills the internal buffer via a call
- * to read() if the internal buffer is empty.
+/* Drop the first len bytes */
+static void buf_consume(web_buf_t *b, size_t len)
+{
+    b->len -= len;
+    memmove(b->data, b->data + len, b->len);
+}
+
+static void set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags >= 0)
+        fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* Write all of iov, waiting a bounded time whenever the socket is full */
+static bool writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return false;
+            struct pollfd pfd = {.fd = fd, .events = POLLOUT};
+            if (poll(&pfd, 1, SEND_TIMEOUT_MS) <= 0)
+                return false;
+            continue;
+        }
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+static void conn_send(web_conn_t *c, struct iovec *iov, int iovcnt)
+{
+    if (!c->closed && !writev_all(c->fd, iov, iovcnt))
+        c->closed = true;
+}
+
+/* Send what is held back by TCP_CORK */
+static void conn_push(web_conn_t *c)
+{
+    int off = 0, on = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    setsockopt(c->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+static web_conn_t *conn_new(int fd)
+{
+    web_conn_t *c = calloc(1, sizeof(web_conn_t));
+    if (!c)
+        return NULL;
+    c->fd = fd;
+    c->next = conns;
+    conns = c;
+#if defined(__linux__)
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = c};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+#endif
+    return c;
+}
+
+static void req_free(web_req_t *req)
+{
+    free(req->cmds.data);
+    free(req);
+}
+
+/* Drop connection once it is closed, or has no more to send, and none of its
+ * requests is left
  */
-/* $begin rio_read */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+static void conn_release(web_conn_t *c)
 {
-    int cnt;
-    while (rp->count <= 0) { /* refill if buf is empty */
-        rp->count = read(rp->fd, rp->buf, sizeof(rp->buf));
-        if (rp->count < 0) {
-            if (errno != EINTR) /* interrupted by sig handler return */
-                return -1;
-        } else if (rp->count == 0) { /* EOF */
+    if ((!c->closed && !c->eof) || c->pending)
+        return;
+
+    web_conn_t **p = &conns;
+    while (*p != c)
+        p = &(*p)->next;
+    *p = c->next;
+#if defined(__linux__)
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+#endif
+    close(c->fd);
+    if (c->body_req)
+        req_free(c->body_req);
+    free(c->in.data);
+    free(c);
+}
+
+/* Read some of what the client sent. Return the number of bytes read, 0 if
+ * there is nothing more for now or ever, or -1 once the client has gone away.
+ */
+static ssize_t conn_read(web_conn_t *c)
+{
+    if (!buf_reserve(&c->in, BUFSIZE))
+        return -1;
+    while (1) {
+        ssize_t n = read(c->fd, c->in.data + c->in.len, c->in.size - c->in.len);
+        if (n > 0) {
+            c->in.len += n;
+            return n;
+        }
+        if (n == 0) {
+            /* Half-closed: requests already received are still answered,
+             * but the socket, readable for good now, is no longer watched.
+             */
+            c->eof = true;
+#if defined(__linux__)
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+#endif
             return 0;
-        } else
-            rp->bufptr = rp->buf; /* reset buffer ptr */
+        }
+        if (n < 0 && errno == EINTR)
+            continue;
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+}
+
+/* Terminate command line being received, dropping blank lines */
+static bool req_end_line(web_req_t *req)
+{
+    if (req->line && req->cmds.data[req->cmds.len - 1] == '\r') {
+        req->cmds.len--;
+        req->line--;
     }
+    if (!req->line)
+        return true;
+    req->line = 0;
+    return buf_append(&req->cmds, "", 1);
+}
 
-    /* Copy min(n, rp->count) bytes from internal buf to user buf */
-    cnt = n;
-    if (rp->count < n)
-        cnt = rp->count;
-    memcpy(usrbuf, rp->bufptr, cnt);
-    rp->bufptr += cnt;
-    rp->count -= cnt;
-    return cnt;
+/* Split text into command lines as it arrives, so that a body of any size
+ * is taken in pieces as small as a read
+ */
+static bool req_feed(web_req_t *req, const char *s, size_t len)
+{
+    const char *end = s + len;
+    while (s < end) {
+        const char *nl = memchr(s, '\n', end - s);
+        size_t n = (nl ? nl : end) - s;
+        /* Overlong lines are cut short, as the console would do */
+        size_t room = MAXCMD - 1 - req->line;
+        size_t keep = n < room ? n : room;
+        if (!buf_append(&req->cmds, s, keep))
+            return false;
+        req->line += keep;
+        if (nl && !req_end_line(req))
+            return false;
+        s += n + (nl != NULL);
+    }
+    return true;
 }
 
-static ssize_t writen(int fd, void *usrbuf, size_t n)
+static void url_decode(char *src, char *dest, int max)
 {
-    size_t nleft = n;
-    char *bufp = usrbuf;
-
-    while (nleft > 0) {
-        ssize_t nwritten = write(fd, bufp, nleft);
-        if (nwritten <= 0) {
-            if (errno == EINTR) { /* interrupted by sig handler return */
-                nwritten = 0;     /* and call write() again */
-            } else
-                return -1; /* errorno set by write() */
+    char *p = src;
+    char code[3] = {0};
+    while (*p && --max) {
+        if (*p == '%') {
+            memcpy(code, ++p, 2);
+            *dest++ = (char) strtoul(code, NULL, 16);
+            p += 2;
+        } else {
+            *dest++ = *p++;
         }
-        nleft -= nwritten;
-        bufp += nwritten;
     }
-    return n;
+    *dest = '\0';
 }
 
-/* robustly read a text line (buffered) */
-static ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+/* Turn path of request into command line, where '/' separates words */
+static bool req_set_path(web_req_t *req, char *uri)
 {
-    char c, *bufp = usrbuf;
-
-    int n;
-    for (n = 1; n < maxlen; n++) {
-        int rc;
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-            *bufp++ = c;
-            if (c == '\n')
-                break;
-        } else if (rc == 0) {
-            if (n == 1)
-                return 0; /* EOF, no data read */
-            break;        /* EOF, some data was read */
-        } else
-            return -1; /* error */
+    char *path = uri[0] == '/' ? uri + 1 : uri;
+    char *query = strchr(path, '?');
+    if (query)
+        *query = '\0';
+
+    char cmd[MAXLINE];
+    url_decode(path, cmd, MAXLINE);
+    for (char *p = cmd; *p; p++) {
+        if (*p == '/' || *p == '\r' || *p == '\n')
+            *p = ' ';
     }
-    *bufp = 0;
-    return n;
+    return req_feed(req, cmd, strlen(cmd)) && req_end_line(req);
+}
+
+/* Find end of header, return its length including the blank line, or 0 */
+static size_t header_length(const char *buf, size_t len)
+{
+    for (size_t i = 0; i + 1 < len; i++) {
+        if (buf[i] != '\n')
+            continue;
+        if (buf[i + 1] == '\n')
+            return i + 2;
+        if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n')
+            return i + 3;
+    }
+    return 0;
+}
+
+static void enqueue(web_req_t *req)
+{
+    req->next = NULL;
+    if (queue_tail)
+        queue_tail->next = req;
+    else
+        queue_head = req;
+    queue_tail = req;
+    req->conn->pending++;
+    /* Anything after this request is not going to be answered */
+    if (!req->keep_alive)
+        req->conn->last = true;
+}
+
+/* Take in body of request, as much of it as has arrived */
+static void conn_body(web_conn_t *c)
+{
+    web_req_t *req = c->body_req;
+    size_t n = c->in.len < c->body_left ? c->in.len : c->body_left;
+    /* Body of anything but a batch is not used */
+    if (req->batch && !req_feed(req, c->in.data, n)) {
+        c->closed = true;
+        return;
+    }
+    buf_consume(&c->in, n);
+    c->body_left -= n;
+    if (c->body_left)
+        return;
+
+    c->body_req = NULL;
+    if (req->batch && !req_end_line(req)) {
+        req_free(req);
+        c->closed = true;
+        return;
+    }
+    enqueue(req);
+}
+
+/* Queue every complete request received on c */
+static void conn_parse(web_conn_t *c)
+{
+    while (!c->closed) {
+        if (c->last) {
+            c->in.len = 0;
+            return;
+        }
+        if (c->body_req) {
+            conn_body(c);
+            if (c->body_req)
+                return;
+            continue;
+        }
+
+        size_t hlen = header_length(c->in.data, c->in.len);
+        if (!hlen) {
+            /* Refuse header growing without bounds */
+            if (c->in.len > 16 * MAXLINE)
+                c->closed = true;
+            return;
+        }
+
+        char line[MAXLINE], method[MAXLINE], uri[MAXLINE], version[16] = "";
+        const char *p = c->in.data, *end = c->in.data + hlen;
+        size_t body = 0;
+        bool keep_alive = false, closing = false;
+        for (bool first = true; p < end; first = false) {
+            const char *nl = memchr(p, '\n', end - p);
+            size_t n = nl - p < MAXLINE - 1 ? nl - p : MAXLINE - 1;
+            memcpy(line, p, n);
+            line[n] = '\0';
+            p = nl + 1;
+
+            if (first) {
+                if (sscanf(line, "%1023s %1023s %15s", method, uri, version) <
+                    2) {
+                    c->closed = true;
+                    return;
+                }
+                continue;
+            }
+            /* Header names and the values looked at are case-insensitive */
+            for (char *q = line; *q; q++)
+                *q = tolower((unsigned char) *q);
+            if (!strncmp(line, "content-length:", 15)) {
+                body = strtoul(line + 15, NULL, 10);
+            } else if (!strncmp(line, "connection:", 11)) {
+                keep_alive = strstr(line + 11, "keep-alive");
+                closing = strstr(line + 11, "close");
+            }
+        }
+        buf_consume(&c->in, hlen);
+
+        web_req_t *req = calloc(1, sizeof(web_req_t));
+        if (!req) {
+            c->closed = true;
+            return;
+        }
+        bool http11 = !strcmp(version, "HTTP/1.1");
+        req->conn = c;
+        req->batch = !strcmp(method, "POST");
+        req->http10 = !http11;
+        req->keep_alive = http11 ? !closing : keep_alive;
+        if (!req->batch && !req_set_path(req, uri)) {
+            req_free(req);
+            c->closed = true;
+            return;
+        }
+
+        if (body) {
+            c->body_req = req;
+            c->body_left = body;
+        } else {
+            enqueue(req);
+        }
+    }
+}
+
+/* Add outcome and output of command just run to response of batch */
+static void batch_add(web_req_t *req, const char *cmd)
+{
+    char head[MAXCMD + 64];
+    int n = snprintf(head, sizeof(head), "%s %zu %s\n",
+                     req->failed ? "error" : "ok", out.len, cmd);
+    buf_append(&batch_out, head, n);
+    buf_append(&batch_out, out.data, out.len);
+    out.len = 0;
+    req->failed = false;
+}
+
+/* Send response to the request whose commands have run */
+static void finish_active(void)
+{
+    web_req_t *req = active;
+    web_conn_t *c = req->conn;
+    /* Records of a batch tell which of its commands failed */
+    web_buf_t *body = req->batch ? &batch_out : &out;
+    bool failed = !req->batch && req->failed;
+    char header[256];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %s\r\nContent-Type: text/plain\r\n"
+                     "Content-Length: %zu\r\n%s\r\n",
+                     failed ? "400 Bad Request" : "200 OK", body->len,
+                     !req->keep_alive ? "Connection: close\r\n"
+                     : req->http10    ? "Connection: keep-alive\r\n"
+                                      : "");
+    /* Header and body leave in one system call */
+    struct iovec iov[2] = {{header, n}, {body->data, body->len}};
+    conn_send(c, iov, 2);
+    if (!c->closed)
+        conn_push(c);
+    out.len = 0;
+    batch_out.len = 0;
+    if (!req->keep_alive)
+        c->closed = true;
+
+    active = NULL;
+    web_connfd = 0;
+    c->pending--;
+    conn_release(c);
+    req_free(req);
+}
+
+/* Copy next command of a request to buf. Return length of command, or 0 if
+ * no request is ready.
+ */
+static int next_cmd(char *buf)
+{
+    while (active || queue_head) {
+        if (!active) {
+            active = queue_head;
+            queue_head = active->next;
+            if (!queue_head)
+                queue_tail = NULL;
+            web_connfd = active->conn->fd;
+        }
+
+        web_req_t *req = active;
+        /* Nothing more is run for a client that went away */
+        if (!req->conn->closed && req->pos < req->cmds.len) {
+            running = req->cmds.data + req->pos;
+            size_t len = strlen(running);
+            req->pos += len + 1;
+            memcpy(buf, running, len + 1);
+            return len;
+        }
+        finish_active();
+    }
+    return 0;
+}
+
+static void accept_clients(void)
+{
+    while (1) {
+        struct sockaddr_in clientaddr;
+        socklen_t clientlen = sizeof(clientaddr);
+        int fd = accept(server_fd, (struct sockaddr *) &clientaddr, &clientlen);
+        if (fd < 0)
+            return;
+        set_nonblocking(fd);
+        if (!conn_new(fd))
+            close(fd);
+    }
+}
+
+static void serve_client(web_conn_t *c)
+{
+    /* Parse after every read, so that a large body is never held whole */
+    while (1) {
+        ssize_t n = conn_read(c);
+        conn_parse(c);
+        if (n < 0)
+            c->closed = true;
+        if (n <= 0 || c->closed)
+            break;
+    }
+    conn_release(c);
+}
+
+/* Wait for clients or standard input. Return 1 if the latter is readable */
+static int web_wait(void)
+{
+    bool stdin_ready = false;
+#if defined(__linux__)
+    struct epoll_event events[64];
+    int n = epoll_wait(epoll_fd, events, 64, -1);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+    for (int i = 0; i < n; i++) {
+        void *ptr = events[i].data.ptr;
+        if (ptr == &stdin_tag)
+            stdin_ready = true;
+        else if (ptr == &server_tag)
+            accept_clients();
+        else
+            serve_client(ptr);
+    }
+#else
+    int nfds = 2;
+    for (web_conn_t *c = conns; c; c = c->next)
+        nfds++;
+    struct pollfd *pfds = calloc(nfds, sizeof(struct pollfd));
+    web_conn_t **owners = calloc(nfds, sizeof(web_conn_t *));
+    if (!pfds || !owners) {
+        free(pfds);
+        free(owners);
+        return -1;
+    }
+    pfds[0].fd = STDIN_FILENO;
+    pfds[1].fd = server_fd;
+    int i = 2;
+    for (web_conn_t *c = conns; c; c = c->next, i++) {
+        /* poll() skips negative descriptors */
+        pfds[i].fd = c->eof ? -1 : c->fd;
+        owners[i] = c;
+    }
+    for (i = 0; i < nfds; i++)
+        pfds[i].events = POLLIN;
+
+    int n = poll(pfds, nfds, -1);
+    if (n > 0) {
+        stdin_ready = pfds[0].revents;
+        if (pfds[1].revents)
+            accept_clients();
+        for (i = 2; i < nfds; i++) {
+            if (pfds[i].revents)
+                serve_client(owners[i]);
+        }
+    }
+    free(pfds);
+    free(owners);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+#endif
+    return stdin_ready;
 }
 
 void web_send(int out_fd, char *buf)
 {
-    writen(out_fd, buf, strlen(buf));
+    if (active && out_fd == active->conn->fd)
+        buf_append(&out, buf, strlen(buf));
+}
+
+void web_error(void)
+{
+    if (active)
+        active->failed = true;
 }
 
 int web_open(int port)
@@ -155,116 +655,43 @@ int web_open(int port)
     /* Make it a listening socket ready to accept connection requests */
     if (listen(listenfd, LISTENQ) < 0)
         return -1;
+    set_nonblocking(listenfd);
+
+#if defined(__linux__)
+    epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0)
+        return -1;
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &server_tag};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+        return -1;
+    ev.data.ptr = &stdin_tag;
+    /* Fails when standard input is a regular file, which is always ready */
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) < 0 &&
+        errno != EPERM)
+        return -1;
+#endif
 
     server_fd = listenfd;
 
     return listenfd;
 }
 
-static void url_decode(char *src, char *dest, int max)
-{
-    char *p = src;
-    char code[3] = {0};
-    while (*p && --max) {
-        if (*p == '%') {
-            memcpy(code, ++p, 2);
-            *dest++ = (char) strtoul(code, NULL, 16);
-            p += 2;
-        } else {
-            *dest++ = *p++;
-        }
-    }
-    *dest = '\0';
-}
-
-static void parse_request(int fd, http_request_t *req)
-{
-    rio_t rio;
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE];
-    req->offset = 0;
-    req->end = 0; /* default */
-
-    rio_readinitb(&rio, fd);
-    rio_readlineb(&rio, buf, MAXLINE);
-    sscanf(buf, "%1023s %1023s", method, uri); /* version is not cared */
-    /* read all */
-    while (buf[0] != '\n' && buf[1] != '\n') { /* \n || \r\n */
-        rio_readlineb(&rio, buf, MAXLINE);
-        if (buf[0] == 'R' && buf[1] == 'a' && buf[2] == 'n') {
-            sscanf(buf, "Range: bytes=%lu-%lu", (unsigned long *) &req->offset,
-                   (unsigned long *) &req->end);
-            /* Range: [start, end] */
-            if (req->end != 0)
-                req->end++;
-        }
-    }
-    char *filename = uri;
-    if (uri[0] == '/') {
-        filename = uri + 1;
-        int length = strlen(filename);
-        if (length == 0) {
-            filename = ".";
-        } else {
-            for (int i = 0; i < length; ++i) {
-                if (filename[i] == '?') {
-                    filename[i] = '\0';
-                    break;
-                }
-            }
-        }
-    }
-    url_decode(filename, req->filename, MAXLINE);
-}
-
-char *web_recv(int fd, struct sockaddr_in *clientaddr)
-{
-    http_request_t req;
-    parse_request(fd, &req);
-
-    char *p = req.filename;
-    /* Change '/' to ' ' */
-    while (*p) {
-        ++p;
-        if (*p == '/')
-            *p = ' ';
-    }
-    char *ret = malloc(strlen(req.filename) + 1);
-    strncpy(ret, req.filename, strlen(req.filename) + 1);
-
-    return ret;
-}
-
 int web_eventmux(char *buf)
 {
-    fd_set listenset;
-
-    FD_ZERO(&listenset);
-    FD_SET(STDIN_FILENO, &listenset);
-    int max_fd = STDIN_FILENO;
-    if (server_fd > 0) {
-        FD_SET(server_fd, &listenset);
-        max_fd = max_fd > server_fd ? max_fd : server_fd;
+    /* The console only waits for input once the last command has run */
+    if (running) {
+        if (active->batch)
+            batch_add(active, running);
+        running = NULL;
     }
-    int result = select(max_fd + 1, &listenset, NULL, NULL, NULL);
-    if (result < 0)
-        return -1;
 
-    if (server_fd > 0 && FD_ISSET(server_fd, &listenset)) {
-        FD_CLR(server_fd, &listenset);
-        struct sockaddr_in clientaddr;
-        socklen_t clientlen = sizeof(clientaddr);
-        int web_connfd =
-            accept(server_fd, (struct sockaddr *) &clientaddr, &clientlen);
-
-        char *p = web_recv(web_connfd, &clientaddr);
-        char *buffer = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
-        web_send(web_connfd, buffer);
-        strncpy(buf, p, strlen(p) + 1);
-        free(p);
-        close(web_connfd);
-        return strlen(buf);
-    }
+    while (1) {
+        int len = next_cmd(buf);
+        if (len > 0)
+            return len;
 
-    FD_CLR(STDIN_FILENO, &listenset);
-    return 0;
+        int stdin_ready = web_wait();
+        if (stdin_ready)
+            return stdin_ready < 0 ? -1 : 0;
+    }
 }
@@ -1,14 +1,21 @@
 #ifndef TINYWEB_H
 #define TINYWEB_H
 
-#include <netinet/in.h>
+/* Client whose request is being run, 0 if none. Output sent through
+ * web_send() to it is collected into the body of the response.
+ */
+extern int web_connfd;
 
 int web_open(int port);
 
-char *web_recv(int fd, struct sockaddr_in *clientaddr);
-
 void web_send(int out_fd, char *buffer);
 
+/* Answer the running request with an error status */
+void web_error(void);
+
+/* Wait until a request is ready or standard input is readable. Copy command
+ * of request to buf and return its length, or return 0 in the latter case.
+ */
 int web_eventmux(char *buf);
 
 #endif